@@ -2,413 +2,3778 @@
 
    James Stanley 2010 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <errno.h>
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 
-#define WHITESPACE " \n\t"
-#define BRACKETS   "()"
-#define LETTER     "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
-#define NUMBER     "0123456789"
+enum type { UNKNOWN=0, VARIABLE, OPERATOR, LPAREN, RPAREN, NOT, SLASHVARS };
+enum oper { OP_OR, OP_AND, OP_XOR, OP_NAND, OP_NOR, OP_IMP, OP_EQU };
+
+typedef struct Node {
+  char type;/* UNKNOWN, VARIABLE, OPERATOR, or NOT */
+  int id;/* variable or operator index */
+} Node;
+
+typedef struct Token {
+  int start, len;/* the token's text, as a view into "input" that is valid
+                  * until the next token is read */
+  char type;/* VARIABLE, OPERATOR, LPAREN, RPAREN, NOT, SLASHVARS or UNKNOWN */
+  int id;/* operator index, for OPERATOR */
+} Token;
+
+/* bytecode instructions. Binary operators use their enum oper values */
+enum insn { I_NOT = OP_EQU + 1, I_VAR, I_CONST, I_END };
+
+typedef struct Insn {
+  unsigned char op;
+  int dst;/* destination register */
+  int a, b;/* source registers, or variable id in a for I_VAR, or 0 or 1 in a
+            * for I_CONST, or the result register in a for I_END */
+} Insn;
+
+/* a node of the expression DAG. Equal subexpressions share a node */
+typedef struct Dag {
+  unsigned char op;/* enum insn, but never I_END */
+  int a, b;/* operand nodes, or as for Insn for I_VAR and I_CONST */
+  int next;/* next node in the same hash chain, or -1 */
+} Dag;
+
+/* truth tables of the binary operators: bit 2*a+b is the result for
+ * operands a and b */
+static const unsigned char op_tt[] =
+  { 0xe, 0x8, 0x6, 0x7, 0x1, 0xb, 0x9 };
+
+/* classes of input characters for next_token(). The symbols of binary
+ * operators are C_OPER plus the operator */
+enum cclass {
+  C_OTHER, C_END, C_SPACE, C_NEWLINE, C_WORD, C_LPAREN, C_RPAREN, C_SLASH,
+  C_BANG, C_MINUS, C_OPER
+};
+
+static const unsigned char char_class[256] = {
+  ['\0'] = C_END,
+  [' '] = C_SPACE, ['\t'] = C_SPACE, ['\n'] = C_NEWLINE,
+  ['a' ... 'z'] = C_WORD, ['A' ... 'Z'] = C_WORD, ['0' ... '9'] = C_WORD,
+  ['_'] = C_WORD, ['\''] = C_WORD,
+  ['('] = C_LPAREN, [')'] = C_RPAREN, ['/'] = C_SLASH, ['!'] = C_BANG,
+  ['-'] = C_MINUS,
+  ['|'] = C_OPER + OP_OR, ['&'] = C_OPER + OP_AND, ['^'] = C_OPER + OP_XOR,
+  ['='] = C_OPER + OP_EQU
+};
+
+/* the words that are operators, in lower case, at the slots given by
+ * keyword_hash(), which has no collisions between them */
+typedef struct Keyword {
+  char name[5];
+  char type;/* OPERATOR or NOT */
+  char id;
+} Keyword;
+
+static const Keyword keyword[16] = {
+  [3] = { "equ", OPERATOR, OP_EQU }, [5] = { "imp", OPERATOR, OP_IMP },
+  [7] = { "not", NOT, 0 }, [8] = { "nand", OPERATOR, OP_NAND },
+  [11] = { "nor", OPERATOR, OP_NOR }, [12] = { "or", OPERATOR, OP_OR },
+  [13] = { "and", OPERATOR, OP_AND }, [15] = { "xor", OPERATOR, OP_XOR }
+};
+
+/* how tightly each binary operator binds, as the left and right binding
+ * powers of a Pratt parser. An operator waiting on the stack is applied before
+ * a new one if its right power is greater than the new one's left power, so a
+ * left power below the right one makes an operator left-associative. From the
+ * loosest to the tightest:
+ *   =  EQU         left-associative
+ *   -> IMP         right-associative
+ *   |  OR, NOR     left-associative
+ *   ^  XOR         left-associative
+ *   &  AND, NAND   left-associative
+ * NOT binds tighter than any of them. With -L, all the binary operators have
+ * the same power, so they are applied from left to right as they always used
+ * to be */
+typedef struct Power {
+  char left, right;
+} Power;
+
+static const Power op_power[] = {
+  [OP_OR] = { 5, 6 }, [OP_AND] = { 9, 10 }, [OP_XOR] = { 7, 8 },
+  [OP_NAND] = { 9, 10 }, [OP_NOR] = { 5, 6 }, [OP_IMP] = { 4, 3 },
+  [OP_EQU] = { 1, 2 }
+};
+static const Power flat_power = { 1, 2 };
+#define NOT_POWER 11
+
+/* set by -L to apply the binary operators from left to right */
+static int left_to_right;
+
+/* the state of parse_token(): the stack of operators and parentheses that are
+ * waiting for their operands, and whether an operand comes next. The stack
+ * keeps its space from one line to the next */
+static struct {
+  Node *op;
+  int nop, size;
+  int operand;/* set when an operand is expected next */
+  int empty;/* set until the first token of the line */
+} parser;
+
+/* expression nodes, which keep their space from one line to the next */
+Node *node;
+int np;
+static int node_size;
+
+/* the variable names of a line are allocated from an arena, which is reset
+ * after the line instead of being freed piece by piece. Its blocks are kept,
+ * so once it has grown to fit the longest line no more memory is allocated */
+typedef struct Block {
+  struct Block *next;
+  size_t size, used;
+} Block;
+
+#define BLOCK_SIZE 65536
+
+static Block *arena;
+static Block *arena_cur;/* the block being allocated from, NULL after a reset */
+
+/* expression DAG built by compile(), with its hash table */
+static Dag *dag;
+static int ndag, dag_size;
+static int dag_root;
+static int *dag_hash;
+static int hash_size;
+
+/* scratch space for compile(), three ints per DAG node */
+static int *dag_scratch;
+static int scratch_size;
+
+/* bytecode for the expression, built by compile() */
+static Insn *code;
+static int ncode, code_size;
+static int nregs;
+
+/* array of variable names, indexed by id in order of first appearance. The
+ * names are kept in the arena, and found by var_hash[], an open addressing
+ * hash table of ids plus 1, with 0 for an empty slot. It is kept at most half
+ * full */
+static char **variable;
+static int num_vars, var_size;
+static int *var_hash;
+static int var_hash_size;
+
+/* tables are numbered with 64 bits, so they can't have more variables than
+ * this. Expressions with more can still be analysed and counted with a BDD */
+#define TABLE_VARS_MAX 64
+
+/* the input is read in blocks into a buffer, which is followed by a NUL.
+ * Tokens are read from it one line at a time, and a token is always whole in
+ * the buffer: if one runs up to the end, it is moved to the start and more
+ * input is read after it. The buffer only grows for a token that fills it, so
+ * lines can be any length */
+#define INPUT_SIZE 65536
+
+static char *input;
+static size_t input_size;/* not counting the NUL */
+static size_t input_pos;/* where next_token() carries on from */
+static size_t input_end;/* the end of the input read so far */
+static int input_eof;
+static int line_done;/* set when the end of the current line has been read */
+
+/* with -b, the part of the mapped input that this process reads instead of
+ * stdin */
+static const char *batch_map;
+static size_t batch_pos, batch_end;
+
+/* print the given message to stderr and exit with code 1 */
+static void die(const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+
+  exit(1);
+}
+
+/* return a buffer of at least 'need' bytes, replacing 'buf' if it is smaller
+ * than that. *size is the size of the buffer, which is kept by the caller
+ * for next time. The contents aren't kept */
+static void *scratch(void *buf, size_t *size, size_t need) {
+  if(need <= *size) return buf;
+  free(buf);
+  if(!(buf = malloc(need))) die("error: out of memory\n");
+  *size = need;
+  return buf;
+}
+
+/* return size bytes from the arena */
+static void *arena_alloc(size_t size) {
+  Block *b;
+  size_t n;
+
+  size = (size + 7) & ~(size_t)7;
+  while(!arena_cur || arena_cur->used + size > arena_cur->size) {
+    /* move on to the next block, adding one if it's missing or too small */
+    b = arena_cur ? arena_cur->next : arena;
+    if(!b || b->size < size) {
+      n = (size > BLOCK_SIZE) ? size : BLOCK_SIZE;
+      if(!(b = malloc(sizeof(Block) + n))) die("error: out of memory\n");
+      b->size = n;
+      b->next = arena_cur ? arena_cur->next : arena;
+      if(arena_cur) arena_cur->next = b;
+      else arena = b;
+    }
+    b->used = 0;
+    arena_cur = b;
+  }
+
+  arena_cur->used += size;
+  return (char *)(arena_cur + 1) + arena_cur->used - size;
+}
+
+/* free everything allocated from the arena, keeping its blocks */
+static void arena_reset(void) {
+  arena_cur = NULL;
+}
+
+/* return a copy of the first len characters of s, allocated from the arena */
+static char *arena_strndup(const char *s, size_t len) {
+  char *p = arena_alloc(len + 1);
+
+  memcpy(p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+/* return the first slot in var_hash[] for a name of len characters */
+static unsigned var_hashval(const char *name, int len) {
+  unsigned h = 0x811c9dc5u;
+  int i;
+
+  for(i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 0x01000193u;
+  return h & (var_hash_size - 1);
+}
+
+/* return the slot in var_hash[] holding the variable named by the len
+ * characters at var_name, or the empty slot where it would go */
+static unsigned var_slot(const char *var_name, int len) {
+  unsigned h;
+  const char *v;
+
+  for(h = var_hashval(var_name, len); var_hash[h];
+      h = (h + 1) & (var_hash_size - 1)) {
+    v = variable[var_hash[h] - 1];
+    if(strncmp(var_name, v, len) == 0 && !v[len]) break;
+  }
+
+  return h;
+}
+
+/* return the id of the variable named by the len characters at var_name, or
+ * -1 if there is none */
+static int var_find(const char *var_name, int len) {
+  if(!num_vars) return -1;
+  return var_hash[var_slot(var_name, len)] - 1;
+}
+
+/* return the variable id for the variable named by the len characters at
+ * var_name, creating it if necessary */
+static int var_id(const char *var_name, int len) {
+  unsigned h;
+  int i;
+
+  /* keep the hash table at most half full */
+  if(2 * (num_vars + 1) > var_hash_size) {
+    var_hash_size = var_hash_size ? var_hash_size * 2 : 128;
+    free(var_hash);
+    if(!(var_hash = calloc(var_hash_size, sizeof(int))))
+      die("error: out of memory\n");
+    for(i = 0; i < num_vars; i++)
+      var_hash[var_slot(variable[i], strlen(variable[i]))] = i + 1;
+  }
+
+  h = var_slot(var_name, len);
+  if(var_hash[h]) return var_hash[h] - 1;
+
+  /* if the variable wasn't found, make it */
+  if(num_vars == var_size) {
+    var_size = var_size ? var_size * 2 : 64;
+    if(!(variable = realloc(variable, var_size * sizeof(char *))))
+      die("error: out of memory\n");
+  }
+  variable[num_vars] = arena_strndup(var_name, len);
+  var_hash[h] = num_vars + 1;
+  return num_vars++;
+}
+
+/* move the input from position keep onwards to the start of the buffer and
+ * read more after it, growing the buffer if it is already full */
+static void input_fill(size_t keep) {
+  ssize_t n;
+
+  if(input_end - keep == input_size) {
+    input_size = input_size ? input_size * 2 : INPUT_SIZE;
+    if(!(input = realloc(input, input_size + 1)))
+      die("error: out of memory\n");
+  }
+
+  memmove(input, input + keep, input_end - keep);
+  input_end -= keep;
+  input_pos = 0;
+
+  if(batch_map) {
+    n = input_size - input_end;
+    if((size_t)n > batch_end - batch_pos) n = batch_end - batch_pos;
+    memcpy(input + input_end, batch_map + batch_pos, n);
+    batch_pos += n;
+  } else {
+    do {
+      n = read(STDIN_FILENO, input + input_end, input_size - input_end);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0) die("error: can't read input: %s\n", strerror(errno));
+  }
+
+  if(n == 0) input_eof = 1;
+  input_end += n;
+  input[input_end] = '\0';
+}
+
+/* start reading the next line, returning 0 at the end of the input */
+static int next_line(void) {
+  if(input_pos == input_end && !input_eof) input_fill(input_end);
+  line_done = 0;
+  return input_pos < input_end;
+}
+
+/* resets the token stream so that it is ready for another string, by
+ * skipping what is left of the current line */
+static void reset_tokstr(void) {
+  char *nl;
+
+  while(!line_done) {
+    if((nl = memchr(input + input_pos, '\n', input_end - input_pos))) {
+      input_pos = nl - input + 1;
+      line_done = 1;
+    } else if(input_eof) {
+      input_pos = input_end;
+      line_done = 1;
+    } else {
+      input_fill(input_end);
+    }
+  }
+}
+
+/* clears the variables, emptying just the slots of var_hash[] they used.
+ * They are emptied in the reverse order to the one they were filled in, so
+ * that the slots a variable was probed past are still full when it is looked
+ * up. Their names are freed with the arena */
+static void clear_vars(void) {
+  int i;
+
+  for(i = num_vars - 1; i >= 0; i--)
+    var_hash[var_slot(variable[i], strlen(variable[i]))] = 0;
+  num_vars = 0;
+}
+
+/* return the slot in keyword[] for a word of 2 to 4 characters, whose first
+ * and last characters are given in lower case */
+static int keyword_hash(int first, int last, int len) {
+  return (2 * first + 14 * last + len) & 15;
+}
+
+/* read the next token of the current line into t, returning 0 at the end of
+ * the line. A token that isn't valid has the type UNKNOWN and starts at the
+ * offending character. Anything after a NUL in a line is ignored */
+static int next_token(Token *t) {
+  const unsigned char *in;
+  const Keyword *k;
+  size_t p;
+  int c, i;
+
+  if(line_done) return 0;
+
+ again:
+  in = (const unsigned char *)input;
+  p = input_pos;
+
+  /* eat whitespace */
+  while((c = char_class[in[p]]) == C_SPACE) p++;
+
+  t->start = p;
+  t->len = 1;
+  t->id = 0;
+
+  switch(c) {
+    case C_END:
+      /* read more at the end of the buffer, unless it's the end of the
+       * input, which ends the line */
+      if(p == input_end && !input_eof) {
+        input_fill(p);
+        goto again;
+      }
+      input_pos = p;
+      reset_tokstr();
+      return 0;
+
+    case C_NEWLINE:
+      input_pos = p + 1;
+      line_done = 1;
+      return 0;
+
+    case C_LPAREN: t->type = LPAREN;    break;
+    case C_RPAREN: t->type = RPAREN;    break;
+    case C_SLASH:  t->type = SLASHVARS; break;
+    case C_BANG:   t->type = NOT;       break;
+
+    case C_MINUS:
+      /* "->" is the only token starting with '-' */
+      if(p + 1 == input_end && !input_eof) {
+        input_fill(p);
+        goto again;
+      }
+      if(in[p + 1] == '>') {
+        t->type = OPERATOR;
+        t->id = OP_IMP;
+        t->len = 2;
+      } else {
+        t->type = UNKNOWN;
+        t->len = 0;
+      }
+      break;
+
+    case C_WORD:
+      while(char_class[in[p + t->len]] == C_WORD) t->len++;
+
+      /* the word may carry on in the input that hasn't been read yet */
+      if(p + t->len == input_end && !input_eof) {
+        input_fill(p);
+        goto again;
+      }
+      t->type = VARIABLE;
+
+      /* check for the operators spelled as words, in any case */
+      if(t->len < 2 || t->len > 4) break;
+      k = keyword + keyword_hash(in[p] | 0x20, in[p + t->len - 1] | 0x20,
+                                 t->len);
+      for(i = 0; i < t->len && (in[p + i] | 0x20) == k->name[i]; i++);
+      if(i == t->len && !k->name[i]) {
+        t->type = k->type;
+        t->id = k->id;
+      }
+      break;
+
+    default:
+      if(c >= C_OPER) {
+        t->type = OPERATOR;
+        t->id = c - C_OPER;
+      } else {
+        /* not a valid operator or variable name */
+        t->type = UNKNOWN;
+        t->len = 0;
+      }
+      break;
+  }
+
+  input_pos = p + t->len;
+  return 1;
+}
+
+/* clear the expression nodes, keeping their space */
+static void clear_nodes(void) {
+  np = 0;
+}
+
+/* pass nodes to this as if they were being output in RPN, and this function
+ * builds the appropriate expression tree */
+static void output(int type, int id) {
+  Node *n;
+
+  /* make another expression node */
+  if(np == node_size) {
+    node_size = node_size ? node_size * 2 : 64;
+    if(!(node = realloc(node, node_size * sizeof(Node))))
+      die("error: out of memory\n");
+  }
+
+  /* get a pointer to the next node */
+  n = node + np++;
+
+  /* assign type and id */
+  n->type = type;
+  n->id = id;
+}
+
+/* start parsing a new expression */
+static void parse_start(void) {
+  parser.nop = 0;
+  parser.operand = 1;
+  parser.empty = 1;
+}
+
+/* return the right binding power of an operator on the parser's stack. A
+ * parenthesis has none, so nothing inside it is applied past it */
+static int right_power(const Node *n) {
+  if(n->type == NOT) return NOT_POWER;
+  if(n->type == OPERATOR)
+    return left_to_right ? flat_power.right : op_power[n->id].right;
+  return 0;
+}
+
+/* push a NOT, OPERATOR or LPAREN onto the parser's stack */
+static void parse_push(int type, int id) {
+  if(parser.nop == parser.size) {
+    parser.size = parser.size ? parser.size * 2 : 64;
+    if(!(parser.op = realloc(parser.op, parser.size * sizeof(Node))))
+      die("error: out of memory\n");
+  }
+  parser.op[parser.nop].type = type;
+  parser.op[parser.nop++].id = id;
+}
+
+/* output the operators on the parser's stack whose right power is greater
+ * than 'power' */
+static void parse_apply(int power) {
+  Node *n;
+
+  while(parser.nop && right_power(n = parser.op + parser.nop - 1) > power) {
+    output(n->type, n->id);
+    parser.nop--;
+  }
+}
+
+/* parse the next token of an expression, outputting its nodes in RPN as soon
+ * as their operands are complete. This is an iterative Pratt parser: instead
+ * of recursing for each operand, the operators waiting for their right
+ * operands are kept on a stack, so expressions can be nested to any depth.
+ * Return -1 after printing an error */
+static int parse_token(const Token *t) {
+  parser.empty = 0;
+
+  if(parser.operand) {
+    switch(t->type) {
+      case VARIABLE:
+        output(VARIABLE, var_id(input + t->start, t->len));
+        parser.operand = 0;
+        return 0;
+
+      case NOT:
+      case LPAREN:
+        parse_push(t->type, 0);
+        return 0;
+
+      default:
+        fprintf(stderr, "error: missing operand before \"%.*s\"\n",
+                t->len, input + t->start);
+        return -1;
+    }
+  }
+
+  switch(t->type) {
+    case OPERATOR:
+      parse_apply(left_to_right ? flat_power.left : op_power[t->id].left);
+      parse_push(OPERATOR, t->id);
+      parser.operand = 1;
+      return 0;
+
+    case RPAREN:
+      /* apply everything back to the LPAREN, and discard it */
+      parse_apply(0);
+      if(!parser.nop) {
+        fprintf(stderr, "error: mismatched parentheses\n");
+        return -1;
+      }
+      parser.nop--;
+      return 0;
+
+    default:
+      fprintf(stderr, "error: missing operator before \"%.*s\"\n",
+              t->len, input + t->start);
+      return -1;
+  }
+}
+
+/* finish parsing an expression, returning -1 after printing an error. An empty
+ * line is left for compile() to report */
+static int parse_end(void) {
+  if(parser.empty) return 0;
+
+  if(parser.operand) {
+    fprintf(stderr, "error: missing operand at the end of the line\n");
+    return -1;
+  }
+
+  parse_apply(0);
+  if(parser.nop) {
+    fprintf(stderr, "error: mismatched parentheses\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* hash a DAG node's contents into dag_hash[] */
+static unsigned dag_hashval(int op, int a, int b) {
+  return ((unsigned)op * 0x9e3779b1u ^ (unsigned)a * 0x85ebca6bu
+          ^ (unsigned)b * 0xc2b2ae35u) & (hash_size - 1);
+}
+
+/* return the DAG node for the given operation, creating it if necessary.
+ * The operands of commutative operators are put in order so that either order
+ * finds the same node */
+static int dag_find(int op, int a, int b) {
+  Dag *d;
+  unsigned h;
+  int i, t;
+
+  if(op < I_NOT && (op_tt[op] & 2) == (op_tt[op] & 4) >> 1 && a > b) {
+    t = a;
+    a = b;
+    b = t;
+  }
+
+  /* keep the hash table at most half full */
+  if(ndag * 2 >= hash_size) {
+    hash_size = hash_size ? hash_size * 2 : 128;
+    if(!(dag_hash = realloc(dag_hash, hash_size * sizeof(int))))
+      die("error: out of memory\n");
+    memset(dag_hash, -1, hash_size * sizeof(int));
+    for(i = 0; i < ndag; i++) {
+      h = dag_hashval(dag[i].op, dag[i].a, dag[i].b);
+      dag[i].next = dag_hash[h];
+      dag_hash[h] = i;
+    }
+  }
+
+  h = dag_hashval(op, a, b);
+  for(i = dag_hash[h]; i >= 0; i = dag[i].next) {
+    if(dag[i].op == op && dag[i].a == a && dag[i].b == b) return i;
+  }
+
+  /* make a new node */
+  if(ndag == dag_size) {
+    dag_size = dag_size ? dag_size * 2 : 64;
+    if(!(dag = realloc(dag, dag_size * sizeof(Dag))))
+      die("error: out of memory\n");
+  }
+
+  d = dag + ndag;
+  d->op = op;
+  d->a = a;
+  d->b = b;
+  d->next = dag_hash[h];
+  dag_hash[h] = ndag;
+
+  return ndag++;
+}
+
+static int dag_node(int op, int a, int b);
+
+/* return the node for g(x), where g is a function of one argument given by
+ * its truth table: bit 0 is g(0) and bit 1 is g(1) */
+static int dag_unary(int g, int x) {
+  switch(g) {
+    case 0:  return dag_find(I_CONST, 0, 0);
+    case 1:  return dag_node(I_NOT, x, 0);
+    case 2:  return x;
+    default: return dag_find(I_CONST, 1, 0);
+  }
+}
+
+/* return the DAG node for applying op (I_NOT or an enum oper) to nodes a and
+ * b, folding operations on constants and trivial identities like X ^ X and
+ * X & !X */
+static int dag_node(int op, int a, int b) {
+  int tt;
+
+  if(op == I_NOT) {
+    if(dag[a].op == I_CONST) return dag_find(I_CONST, !dag[a].a, 0);
+    if(dag[a].op == I_NOT) return dag[a].a;
+    return dag_find(I_NOT, a, 0);
+  }
+
+  tt = op_tt[op];
+
+  if(dag[a].op == I_CONST)
+    return dag_unary((tt >> (2 * dag[a].a)) & 3, b);
+  if(dag[b].op == I_CONST)
+    return dag_unary(((tt >> dag[b].a) & 1) | ((tt >> (1 + dag[b].a)) & 2), a);
+  if(a == b)
+    return dag_unary((tt & 1) | ((tt >> 2) & 2), a);
+  if(dag[a].op == I_NOT && dag[a].a == b)
+    return dag_unary(((tt >> 2) & 1) | (tt & 2), b);
+  if(dag[b].op == I_NOT && dag[b].a == a)
+    return dag_unary(((tt >> 1) & 1) | ((tt >> 1) & 2), a);
+
+  return dag_find(op, a, b);
+}
+
+/* compile the expression nodes into bytecode in code[], by way of the DAG in
+ * dag[] so that each distinct subexpression is computed only once. Return -2
+ * on stack underflow, and -3 if there isn't exactly one value left on the
+ * stack at the end */
+static int compile(void) {
+  static int *stack;
+  static int stack_size;
+  int sp = 0;
+  int *uses, *reg;
+  int *free_reg;
+  int nfree = 0;
+  Insn *c;
+  Dag *d;
+  int i;
+
+  ndag = 0;
+  if(hash_size) memset(dag_hash, -1, hash_size * sizeof(int));
+
+  /* build the DAG, checking the stack as we go */
+  for(i = 0; i < np; i++) {
+    switch(node[i].type) {
+      case VARIABLE:
+        if(sp == stack_size) {
+          stack_size = stack_size ? stack_size * 2 : 64;
+          if(!(stack = realloc(stack, stack_size * sizeof(int))))
+            die("error: out of memory\n");
+        }
+        stack[sp++] = dag_find(I_VAR, node[i].id, 0);
+        break;
+
+      case OPERATOR:
+        if(sp <= 1) return -2;
+        sp--;
+        stack[sp - 1] = dag_node(node[i].id, stack[sp - 1], stack[sp]);
+        break;
+
+      case NOT:
+        if(sp <= 0) return -2;
+        stack[sp - 1] = dag_node(I_NOT, stack[sp - 1], 0);
+        break;
+    }
+  }
+
+  if(sp != 1) return -3;
+  dag_root = stack[0];
+
+  /* count the uses of each node reachable from the root. Operands always
+   * come before the nodes that use them */
+  if(scratch_size < 3 * ndag) {
+    scratch_size = 3 * dag_size;
+    free(dag_scratch);
+    if(!(dag_scratch = malloc(scratch_size * sizeof(int))))
+      die("error: out of memory\n");
+  }
+  uses = dag_scratch;
+  memset(uses, 0, ndag * sizeof(int));
+  reg = uses + ndag;
+  free_reg = reg + ndag;
+
+  uses[dag_root] = 1;
+  for(i = dag_root; i >= 0; i--) {
+    if(!uses[i]) continue;
+    d = dag + i;
+    if(d->op <= I_NOT) uses[d->a]++;
+    if(d->op < I_NOT) uses[d->b]++;
+  }
+
+  /* one instruction per reachable node, plus I_END */
+  if(ndag + 1 > code_size) {
+    code_size = ndag + 1;
+    if(!(code = realloc(code, code_size * sizeof(Insn))))
+      die("error: out of memory\n");
+  }
+
+  /* emit the reachable nodes in order, giving each a register which is freed
+   * after its last use */
+  ncode = 0;
+  nregs = 0;
+  for(i = 0; i <= dag_root; i++) {
+    if(!uses[i]) continue;
+    d = dag + i;
+    c = code + ncode++;
+    c->op = d->op;
+    c->a = d->a;
+    c->b = d->b;
+
+    if(d->op <= I_NOT) {
+      c->a = reg[d->a];
+      if(--uses[d->a] == 0) free_reg[nfree++] = c->a;
+    }
+    if(d->op < I_NOT) {
+      c->b = reg[d->b];
+      if(--uses[d->b] == 0) free_reg[nfree++] = c->b;
+    }
+
+    c->dst = reg[i] = nfree ? free_reg[--nfree] : nregs++;
+  }
+
+  c = code + ncode++;
+  c->op = I_END;
+  c->a = reg[dag_root];
+
+  return 0;
+}
+
+/* bit k of low_mask[b] is the value of variable b in row k of a 64-row word,
+ * for the variables that change within a single word */
+static const uint64_t low_mask[6] = {
+  0xaaaaaaaaaaaaaaaaULL, 0xccccccccccccccccULL, 0xf0f0f0f0f0f0f0f0ULL,
+  0xff00ff00ff00ff00ULL, 0xffff0000ffff0000ULL, 0xffffffff00000000ULL
+};
+
+/* return the values of the given variable for the 64 rows in 'word', i.e. the
+ * rows 64*word to 64*word+63 */
+static uint64_t var_word(int id, uint64_t word) {
+  if(id < 6) return low_mask[id];
+  return ((word >> (id - 6)) & 1) ? ~(uint64_t)0 : 0;
+}
+
+/* evaluate the bytecode for all 64 rows in 'word' at once, bit k of the
+ * result being the value for row 64*word+k. With GCC this is a direct-threaded
+ * interpreter, jumping straight from one instruction's handler to the next */
+static uint64_t run_code(uint64_t word) {
+  static __thread uint64_t *reg;
+  static __thread int reg_size;
+  const Insn *ip = code;
+
+  /* an expression can have any number of registers, so they are kept on the
+   * heap rather than the stack */
+  if(nregs > reg_size) {
+    free(reg);
+    if(!(reg = malloc(nregs * sizeof(uint64_t))))
+      die("error: out of memory\n");
+    reg_size = nregs;
+  }
+
+#ifdef __GNUC__
+  static void *const label[] = {
+    [OP_OR] = &&L_OP_OR, [OP_AND] = &&L_OP_AND, [OP_XOR] = &&L_OP_XOR,
+    [OP_NAND] = &&L_OP_NAND, [OP_NOR] = &&L_OP_NOR, [OP_IMP] = &&L_OP_IMP,
+    [OP_EQU] = &&L_OP_EQU, [I_NOT] = &&L_I_NOT, [I_VAR] = &&L_I_VAR,
+    [I_CONST] = &&L_I_CONST, [I_END] = &&L_I_END
+  };
+#define CASE(op) L_##op
+#define NEXT goto *label[(++ip)->op]
+
+  goto *label[ip->op];
+#else
+#define CASE(op) case op
+#define NEXT ip++; continue
+
+  for(;;) switch(ip->op)
+#endif
+  {
+    CASE(OP_OR):   reg[ip->dst] = reg[ip->a] | reg[ip->b];     NEXT;
+    CASE(OP_AND):  reg[ip->dst] = reg[ip->a] & reg[ip->b];     NEXT;
+    CASE(OP_XOR):  reg[ip->dst] = reg[ip->a] ^ reg[ip->b];     NEXT;
+    CASE(OP_NAND): reg[ip->dst] = ~(reg[ip->a] & reg[ip->b]);  NEXT;
+    CASE(OP_NOR):  reg[ip->dst] = ~(reg[ip->a] | reg[ip->b]);  NEXT;
+    CASE(OP_IMP):  reg[ip->dst] = ~reg[ip->a] | reg[ip->b];    NEXT;
+    CASE(OP_EQU):  reg[ip->dst] = ~(reg[ip->a] ^ reg[ip->b]);  NEXT;
+    CASE(I_NOT):   reg[ip->dst] = ~reg[ip->a];                 NEXT;
+    CASE(I_VAR):   reg[ip->dst] = var_word(ip->a, word);       NEXT;
+    CASE(I_CONST): reg[ip->dst] = -(uint64_t)ip->a;            NEXT;
+    CASE(I_END):   return reg[ip->a];
+  }
+
+#undef CASE
+#undef NEXT
+}
+
+/* number of 64-row words evaluated together by evaluate_range() in block
+ * mode */
+#define BLOCK_WORDS 8
+
+/* a set of kernels applying operators to whole arrays of words */
+typedef struct Isa {
+  const char *name;
+  int (*supported)(void);
+  /* d[i] = a[i] op b[i] for 0 <= i < n */
+  void (*apply)(int op, uint64_t *d, const uint64_t *a, const uint64_t *b,
+                size_t n);
+  /* d[i] = ~a[i] for 0 <= i < n */
+  void (*invert)(uint64_t *d, const uint64_t *a, size_t n);
+} Isa;
+
+static int scalar_supported(void) {
+  return 1;
+}
+
+static void scalar_apply(int op, uint64_t *d, const uint64_t *a,
+                         const uint64_t *b, size_t n) {
+  size_t i;
+
+#define SCALAR_LOOP(expr) for(i = 0; i < n; i++) d[i] = (expr); break
+
+  switch(op) {
+    case OP_OR:   SCALAR_LOOP(a[i] | b[i]);
+    case OP_AND:  SCALAR_LOOP(a[i] & b[i]);
+    case OP_XOR:  SCALAR_LOOP(a[i] ^ b[i]);
+    case OP_NAND: SCALAR_LOOP(~(a[i] & b[i]));
+    case OP_NOR:  SCALAR_LOOP(~(a[i] | b[i]));
+    case OP_IMP:  SCALAR_LOOP(~a[i] | b[i]);
+    case OP_EQU:  SCALAR_LOOP(~(a[i] ^ b[i]));
+  }
+}
+
+static void scalar_invert(uint64_t *d, const uint64_t *a, size_t n) {
+  size_t i;
+
+  for(i = 0; i < n; i++) d[i] = ~a[i];
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+
+/* AVX2: 4 words, i.e. 256 rows, per instruction. n must be a multiple of 4 */
+static int avx2_supported(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void avx2_apply(int op, uint64_t *d, const uint64_t *a,
+                       const uint64_t *b, size_t n) {
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  __m256i x, y;
+  size_t i;
+
+#define AVX2_LOOP(expr)                                   \
+  for(i = 0; i < n; i += 4) {                             \
+    x = _mm256_loadu_si256((const __m256i *)(a + i));     \
+    y = _mm256_loadu_si256((const __m256i *)(b + i));     \
+    _mm256_storeu_si256((__m256i *)(d + i), (expr));      \
+  }                                                       \
+  break
+
+  switch(op) {
+    case OP_OR:   AVX2_LOOP(_mm256_or_si256(x, y));
+    case OP_AND:  AVX2_LOOP(_mm256_and_si256(x, y));
+    case OP_XOR:  AVX2_LOOP(_mm256_xor_si256(x, y));
+    case OP_NAND: AVX2_LOOP(_mm256_xor_si256(_mm256_and_si256(x, y), ones));
+    case OP_NOR:  AVX2_LOOP(_mm256_xor_si256(_mm256_or_si256(x, y), ones));
+    case OP_IMP:  AVX2_LOOP(_mm256_xor_si256(_mm256_andnot_si256(y, x), ones));
+    case OP_EQU:  AVX2_LOOP(_mm256_xor_si256(_mm256_xor_si256(x, y), ones));
+  }
+}
+
+__attribute__((target("avx2")))
+static void avx2_invert(uint64_t *d, const uint64_t *a, size_t n) {
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  __m256i x;
+  size_t i;
+
+  for(i = 0; i < n; i += 4) {
+    x = _mm256_loadu_si256((const __m256i *)(a + i));
+    _mm256_storeu_si256((__m256i *)(d + i), _mm256_xor_si256(x, ones));
+  }
+}
+
+/* AVX-512: 8 words, i.e. 512 rows, per instruction. Every operator is a single
+ * vpternlogq, whose immediate is the truth table of the operator with
+ * a = 0xf0 and b = 0xcc. n must be a multiple of 8 */
+static int avx512_supported(void) {
+  return __builtin_cpu_supports("avx512f");
+}
+
+__attribute__((target("avx512f")))
+static void avx512_apply(int op, uint64_t *d, const uint64_t *a,
+                         const uint64_t *b, size_t n) {
+  __m512i x, y;
+  size_t i;
+
+#define AVX512_LOOP(imm)                                        \
+  for(i = 0; i < n; i += 8) {                                   \
+    x = _mm512_loadu_si512(a + i);                              \
+    y = _mm512_loadu_si512(b + i);                              \
+    _mm512_storeu_si512(d + i, _mm512_ternarylogic_epi64(x, y, y, (imm))); \
+  }                                                             \
+  break
+
+  switch(op) {
+    case OP_OR:   AVX512_LOOP(0xfc);
+    case OP_AND:  AVX512_LOOP(0xc0);
+    case OP_XOR:  AVX512_LOOP(0x3c);
+    case OP_NAND: AVX512_LOOP(0x3f);
+    case OP_NOR:  AVX512_LOOP(0x03);
+    case OP_IMP:  AVX512_LOOP(0xcf);
+    case OP_EQU:  AVX512_LOOP(0xc3);
+  }
+}
+
+__attribute__((target("avx512f")))
+static void avx512_invert(uint64_t *d, const uint64_t *a, size_t n) {
+  __m512i x;
+  size_t i;
+
+  for(i = 0; i < n; i += 8) {
+    x = _mm512_loadu_si512(a + i);
+    _mm512_storeu_si512(d + i, _mm512_ternarylogic_epi64(x, x, x, 0x0f));
+  }
+}
+#endif
+
+/* available kernels, best first */
+static const Isa isas[] = {
+#ifdef HAVE_X86_KERNELS
+  { "avx512", avx512_supported, avx512_apply, avx512_invert },
+  { "avx2",   avx2_supported,   avx2_apply,   avx2_invert },
+#endif
+  { "scalar", scalar_supported, scalar_apply, scalar_invert },
+  { NULL, NULL, NULL, NULL }
+};
+
+/* kernels in use, chosen by select_isa() */
+static const Isa *isa;
+
+/* use the named kernels, or the best supported ones if name is NULL */
+static void select_isa(const char *name) {
+  const Isa *i;
+
+  for(i = isas; i->name; i++) {
+    if(name && strcasecmp(name, i->name) != 0) continue;
+
+    if(!i->supported()) {
+      if(name) die("error: %s is not supported on this cpu\n", name);
+      continue;
+    }
+
+    isa = i;
+    return;
+  }
+
+  die("error: unknown instruction set \"%s\"\n", name);
+}
+
+/* evaluate the bytecode for the 'nwords' words starting at 'word', with bit
+ * k of out[j] being the value for row 64*(word+j)+k. The bytecode is run one
+ * instruction at a time over all of the words, so every register is a vector
+ * of 'nwords' words. nwords must be a multiple of BLOCK_WORDS */
+static void evaluate_range(uint64_t word, uint64_t nwords, uint64_t *out) {
+  static __thread uint64_t *reg;
+  static __thread uint64_t reg_size;
+  const Insn *ip;
+  uint64_t *d;
+  uint64_t need;
+  uint64_t j;
+
+  need = nregs * nwords;
+  if(need > reg_size) {
+    free(reg);
+    if(!(reg = malloc(need * sizeof(uint64_t))))
+      die("error: out of memory\n");
+    reg_size = need;
+  }
+
+#define VEC(r) (reg + (r) * nwords)
+
+  for(ip = code; ip->op != I_END; ip++) {
+    d = VEC(ip->dst);
+
+    switch(ip->op) {
+      case I_VAR:
+        for(j = 0; j < nwords; j++) d[j] = var_word(ip->a, word + j);
+        break;
+
+      case I_CONST:
+        for(j = 0; j < nwords; j++) d[j] = -(uint64_t)ip->a;
+        break;
+
+      case I_NOT:
+        isa->invert(d, VEC(ip->a), nwords);
+        break;
+
+      default:
+        isa->apply(ip->op, d, VEC(ip->a), VEC(ip->b), nwords);
+        break;
+    }
+  }
+
+  memcpy(out, VEC(ip->a), nwords * sizeof(uint64_t));
+
+#undef VEC
+}
+
+/* evaluation modes. MODE_JIT is the default where it is available, and
+ * MODE_CODE everywhere else */
+enum mode { MODE_CODE, MODE_BLOCK, MODE_TABLE, MODE_JIT, MODE_JITROW,
+            MODE_GRAY };
+static const char *mode_name[] =
+  { "code", "block", "table", "jit", "jitrow", "gray", NULL };
+static int mode = -1;
+
+/* order in which rows are printed: counting down from all-true, or in Gray
+ * code order from all-true, changing one variable per row */
+enum order { ORDER_CLASSIC, ORDER_GRAY };
+static int order = ORDER_CLASSIC;
+
+/* how the rows of a table are written out when they are formatted by one
+ * thread: directly, or handed to a writer thread. The writer thread is the
+ * default when there is more than one core. OUT_SPLICE is like OUT_THREAD, but
+ * hands the pages to stdout with vmsplice() if it is a pipe */
+enum out_method { OUT_WRITE, OUT_THREAD, OUT_SPLICE };
+static const char *out_name[] = { "write", "thread", "splice", NULL };
+static int out_method = -1;
+
+/* with -1 or -0, only the rows with that result are printed */
+static int only = -1;
+
+/* with -B, tables are written in the binary format below instead of text */
+static int binary;
+
+/* with -l, runs of rows with the same result are printed instead of rows */
+static int rle;
+
+/* text formats for the rows, chosen with -F. With -x, only the result column
+ * is printed */
+enum format { FMT_TABLE, FMT_CSV, FMT_TSV, FMT_BITS };
+static const char *format_name[] = { "table", "csv", "tsv", "bits", NULL };
+static int format = FMT_TABLE;
+static int result_only;
+
+/* set with -o, when stdout is a file that tables can be mapped into */
+static int map_out;
+
+/* with -R, only the rows in positions from up to but not including to are
+ * printed, or up to the end if to is 0. The header is printed with position 0,
+ * and the blank line after the table as if it were the row after the last, so
+ * the output for consecutive ranges joins up into that of the whole table */
+static struct {
+  uint64_t from, to;
+} range;
+
+/* number of worker threads for big tables, defaulting to one per core. The
+ * threads' handles are kept on the stack, so there is a limit */
+static int nthreads;
+#define THREADS_MAX 1024
+
+/* maximum memory, in bytes, used for the vectors in table mode */
+static uint64_t table_mem = 256 << 20;
+
+/* return the number of words to evaluate at once in table mode: the whole
+ * table if the stack of vectors and the result fit in table_mem, otherwise the
+ * largest tile that does. Each worker thread has its own vectors, so they
+ * share the limit */
+static uint64_t table_tile(void) {
+  uint64_t tile;
+  uint64_t vectors = nregs + 1;
+  uint64_t mem = (nthreads > 1) ? table_mem / nthreads : table_mem;
+
+  tile = (num_vars > 6) ? (uint64_t)1 << (num_vars - 6) : 1;
+  if(tile < BLOCK_WORDS) tile = BLOCK_WORDS;
+
+  while(tile > BLOCK_WORDS && vectors * tile * sizeof(uint64_t) > mem)
+    tile /= 2;
+
+  return tile;
+}
+
+/* parse a byte count with an optional K, M or G suffix */
+static uint64_t parse_size(const char *s) {
+  char *end;
+  uint64_t n = strtoull(s, &end, 0);
+
+  switch(toupper(*end)) {
+    case 'G': n <<= 10; /* fall through */
+    case 'M': n <<= 10; /* fall through */
+    case 'K': n <<= 10; end++; break;
+  }
+
+  if(end == s || *end) die("error: invalid size \"%s\"\n", s);
+
+  return n;
+}
+
+/* parse the number of threads for -j */
+static int parse_threads(const char *s) {
+  char *end;
+  long n = strtol(s, &end, 10);
+
+  if(end == s || *end || n < 1 || n > THREADS_MAX)
+    die("error: the number of threads must be from 1 to %d\n", THREADS_MAX);
+
+  return n;
+}
+
+/* native code compiled from the expression by jit_compile(). In the word
+ * form it is called with a word number and returns the 64 results for that
+ * word like evaluate_range(); in the row form it is called with a row number
+ * and returns the result for that row in bit 0 */
+typedef uint64_t (*JitFn)(uint64_t);
+
+/* file to write generated code to, if any */
+static FILE *jit_dump;
+
+#if defined(__x86_64__) && defined(__unix__)
+#define HAVE_JIT
+
+/* x86-64 register numbers */
+#define RAX 0
+#define RDI 7
+#define R11 11
+
+/* stack slots are kept in these registers, with slot 0 in rax so that the
+ * result is already in place for returning. Deeper slots are spilled to the
+ * machine stack, and r11 is kept free as a scratch register */
+static const int jit_reg[] = { RAX, 1, 2, 6, 8, 9, 10 };
+#define JIT_REGS 7
+
+/* location numbers below 16 are registers, the rest are spill slots */
+#define SPILL 16
+
+/* the spill slots are on the machine stack, so expressions that need more
+ * than this many are left to the interpreter */
+#define JIT_SPILL_MAX 4096
+
+static unsigned char *jit_ptr;
+
+/* return the location of the given stack slot */
+static int jit_loc(int slot) {
+  if(slot < JIT_REGS) return jit_reg[slot];
+  return SPILL + slot - JIT_REGS;
+}
+
+/* emit a 64-bit instruction with the given opcode, reg field and r/m
+ * location */
+static void jit_rm(int opcode, int reg, int loc) {
+  int rm = (loc < SPILL) ? loc : 4;
+
+  *jit_ptr++ = 0x48 | ((reg >> 3) << 2) | (rm >> 3);
+  *jit_ptr++ = opcode;
+
+  if(loc < SPILL) {
+    *jit_ptr++ = 0xc0 | ((reg & 7) << 3) | (rm & 7);
+  } else {
+    /* [rsp + disp32] */
+    *jit_ptr++ = 0x84 | ((reg & 7) << 3);
+    *jit_ptr++ = 0x24;
+    *(uint32_t *)jit_ptr = (loc - SPILL) * 8;
+    jit_ptr += 4;
+  }
+}
+
+/* emit a group instruction with an 8-bit immediate, e.g. shr, and, xor */
+static void jit_rm_imm8(int opcode, int ext, int loc, int imm) {
+  jit_rm(opcode, ext, loc);
+  *jit_ptr++ = imm;
+}
+
+/* emit "mov reg, imm64" */
+static void jit_mov_imm(int reg, uint64_t imm) {
+  *jit_ptr++ = 0x48 | (reg >> 3);
+  *jit_ptr++ = 0xb8 + (reg & 7);
+  memcpy(jit_ptr, &imm, sizeof(imm));
+  jit_ptr += sizeof(imm);
+}
+
+/* emit code to invert the value at 'loc': all 64 bits in the word form, only
+ * bit 0 in the row form */
+static void jit_invert(int loc, int word_form) {
+  if(word_form) jit_rm(0xf7, 2, loc);       /* not loc */
+  else jit_rm_imm8(0x83, 6, loc, 1);        /* xor loc, 1 */
+}
+
+/* compile the bytecode to native code, in the word form or the row form.
+ * Return NULL if the code can't be made executable, or needs too many spill
+ * slots */
+static JitFn jit_compile(int word_form, size_t *size) {
+  static const int opcode[] = {
+    [OP_OR] = 0x0b, [OP_AND] = 0x23, [OP_XOR] = 0x33, [OP_NAND] = 0x23,
+    [OP_NOR] = 0x0b, [OP_IMP] = 0x0b, [OP_EQU] = 0x33
+  };
+  unsigned char *buf;
+  const Insn *ip;
+  int spills = nregs - JIT_REGS;
+  int d, a, b, t;
+
+  if(spills > JIT_SPILL_MAX) return NULL;
+
+  /* no instruction needs more than 32 bytes of code */
+  *size = (32 * (size_t)ncode + 32 + 4095) & ~(size_t)4095;
+  buf = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+  if(buf == MAP_FAILED) return NULL;
+  jit_ptr = buf;
+
+  /* sub rsp, spills * 8 */
+  if(spills > 0) {
+    *jit_ptr++ = 0x48; *jit_ptr++ = 0x81; *jit_ptr++ = 0xec;
+    *(uint32_t *)jit_ptr = spills * 8;
+    jit_ptr += 4;
+  }
+
+  for(ip = code; ip->op != I_END; ip++) {
+    d = jit_loc(ip->dst);
+
+    switch(ip->op) {
+      case I_VAR:
+        t = (d < SPILL) ? d : R11;
+        if(word_form && ip->a < 6) {
+          jit_mov_imm(t, low_mask[ip->a]);
+        } else {
+          /* the variable's bit of the row or word number, which in the word
+           * form is negated to fill the whole word */
+          jit_rm(0x8b, t, RDI);                               /* mov t, rdi */
+          jit_rm_imm8(0xc1, 5, t, ip->a - (word_form ? 6 : 0)); /* shr t */
+          jit_rm_imm8(0x83, 4, t, 1);                         /* and t, 1 */
+          if(word_form) jit_rm(0xf7, 3, t);                   /* neg t */
+        }
+        if(t != d) jit_rm(0x89, t, d);                        /* mov d, t */
+        break;
+
+      case I_CONST:
+        t = (d < SPILL) ? d : R11;
+        jit_mov_imm(t, word_form ? -(uint64_t)ip->a : ip->a);
+        if(t != d) jit_rm(0x89, t, d);                        /* mov d, t */
+        break;
+
+      case I_NOT:
+        a = jit_loc(ip->a);
+        t = (d == a || d < SPILL) ? d : R11;
+        if(t != a) jit_rm(0x8b, t, a);                        /* mov t, a */
+        jit_invert(t, word_form);
+        if(t != d) jit_rm(0x89, t, d);                        /* mov d, t */
+        break;
+
+      default:
+        a = jit_loc(ip->a);
+        b = jit_loc(ip->b);
+        /* don't overwrite b before using it if it is also the destination */
+        if(d == b && a != b && ip->op != OP_IMP) {
+          b = a;
+          a = d;
+        }
+        t = (d < SPILL && (d != b || a == b)) ? d : R11;
+        if(t != a) jit_rm(0x8b, t, a);                        /* mov t, a */
+        if(ip->op == OP_IMP) jit_invert(t, word_form);
+        jit_rm(opcode[ip->op], t, b);                         /* op t, b */
+        if(ip->op == OP_NAND || ip->op == OP_NOR || ip->op == OP_EQU)
+          jit_invert(t, word_form);
+        if(t != d) jit_rm(0x89, t, d);                        /* mov d, t */
+        break;
+    }
+  }
+
+  /* mov rax, result */
+  if(jit_loc(ip->a) != RAX) jit_rm(0x8b, RAX, jit_loc(ip->a));
+
+  /* add rsp, spills * 8 */
+  if(spills > 0) {
+    *jit_ptr++ = 0x48; *jit_ptr++ = 0x81; *jit_ptr++ = 0xc4;
+    *(uint32_t *)jit_ptr = spills * 8;
+    jit_ptr += 4;
+  }
+  *jit_ptr++ = 0xc3;                                          /* ret */
+
+  if(jit_dump) fwrite(buf, 1, jit_ptr - buf, jit_dump);
+
+  if(mprotect(buf, *size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(buf, *size);
+    return NULL;
+  }
+
+  return (JitFn)buf;
+}
+
+/* free code made by jit_compile() */
+static void jit_free(JitFn fn, size_t size) {
+  munmap((void *)fn, size);
+}
+#else
+/* no JIT on this host: always fall back to the interpreter */
+static JitFn jit_compile(int word_form, size_t *size) {
+  return NULL;
+}
+
+static void jit_free(JitFn fn, size_t size) {
+}
+#endif
+
+/* number of words to evaluate at once in gray mode */
+#define GRAY_WORDS 1024
+
+/* state for gray mode: the variables each node depends on, and the reachable
+ * nodes in order in gray_list. gray_list[gray_start[0]..gray_start[1]) is all
+ * of them, and gray_list[gray_start[v+1]..gray_start[v+2]) the ones that
+ * depend on variable v. gray_gen counts calls to gray_prepare() */
+static uint64_t *gray_dep;
+static int *gray_list;
+static int gray_start[TABLE_VARS_MAX + 2];
+static uint64_t gray_vars;
+static int gray_gen;
+
+/* each thread's cached value of every DAG node for the word gray_word, valid
+ * if gray_valid is set and gray_seen is gray_gen */
+static __thread uint64_t *gray_val;
+static __thread int gray_val_size;
+static __thread uint64_t gray_word;
+static __thread int gray_valid;
+static __thread int gray_seen;
+
+/* set up gray mode for the DAG made by compile() */
+static void gray_prepare(void) {
+  static size_t dep_size, list_size, reach_size;
+  static char *reach;
+  int n = 0;
+  int i, v;
+
+  gray_dep = scratch(gray_dep, &dep_size, ndag * sizeof(uint64_t));
+  gray_list = scratch(gray_list, &list_size,
+                      (num_vars + 1) * ndag * sizeof(int));
+  reach = scratch(reach, &reach_size, ndag);
+  memset(gray_dep, 0, ndag * sizeof(uint64_t));
+  memset(reach, 0, ndag);
+
+  /* find the reachable nodes */
+  reach[dag_root] = 1;
+  for(i = dag_root; i >= 0; i--) {
+    if(!reach[i]) continue;
+    if(dag[i].op <= I_NOT) reach[dag[i].a] = 1;
+    if(dag[i].op < I_NOT) reach[dag[i].b] = 1;
+  }
+
+  /* the variables within a word never change, so only the others count as
+   * dependencies */
+  for(i = 0; i <= dag_root; i++) {
+    if(!reach[i]) continue;
+    gray_list[n++] = i;
+    if(dag[i].op == I_VAR && dag[i].a >= 6)
+      gray_dep[i] = (uint64_t)1 << dag[i].a;
+    if(dag[i].op <= I_NOT) gray_dep[i] |= gray_dep[dag[i].a];
+    if(dag[i].op < I_NOT) gray_dep[i] |= gray_dep[dag[i].b];
+  }
+
+  gray_start[0] = 0;
+  for(v = 0; v < num_vars; v++) {
+    gray_start[v + 1] = n;
+    for(i = gray_start[0]; i < gray_start[1]; i++) {
+      if(gray_dep[gray_list[i]] & ((uint64_t)1 << v))
+        gray_list[n++] = gray_list[i];
+    }
+  }
+  gray_start[num_vars + 1] = n;
+
+  /* mask of the variables that exist, as words past the end of the table
+   * may be evaluated too */
+  gray_vars = (num_vars < 64) ? ((uint64_t)1 << num_vars) - 1 : ~(uint64_t)0;
+  gray_gen++;
+}
+
+/* recompute DAG node i for 'word' from the cached values of its operands */
+static void gray_eval(int i, uint64_t word) {
+  const Dag *d = dag + i;
+  uint64_t *v = gray_val;
+
+  switch(d->op) {
+    case I_VAR:   v[i] = var_word(d->a, word);    break;
+    case I_CONST: v[i] = -(uint64_t)d->a;         break;
+    case I_NOT:   v[i] = ~v[d->a];                break;
+    case OP_OR:   v[i] = v[d->a] | v[d->b];       break;
+    case OP_AND:  v[i] = v[d->a] & v[d->b];       break;
+    case OP_XOR:  v[i] = v[d->a] ^ v[d->b];       break;
+    case OP_NAND: v[i] = ~(v[d->a] & v[d->b]);    break;
+    case OP_NOR:  v[i] = ~(v[d->a] | v[d->b]);    break;
+    case OP_IMP:  v[i] = ~v[d->a] | v[d->b];      break;
+    case OP_EQU:  v[i] = ~(v[d->a] ^ v[d->b]);    break;
+  }
+}
+
+/* bring the cached values up to date for 'word', recomputing only the nodes
+ * that depend on the variables that differ from the previous word */
+static void gray_update(uint64_t word) {
+  uint64_t changed = ((word ^ gray_word) << 6) & gray_vars;
+  int i, v;
+
+  /* start again if this is a new expression */
+  if(gray_seen != gray_gen) {
+    if(gray_val_size < ndag) {
+      free(gray_val);
+      if(!(gray_val = malloc(ndag * sizeof(uint64_t))))
+        die("error: out of memory\n");
+      gray_val_size = ndag;
+    }
+    gray_seen = gray_gen;
+    gray_valid = 0;
+  }
+
+  if(!gray_valid) {
+    for(i = gray_start[0]; i < gray_start[1]; i++)
+      gray_eval(gray_list[i], word);
+    gray_valid = 1;
+  } else if(changed && !(changed & (changed - 1))) {
+    /* exactly one variable changed */
+    v = __builtin_ctzll(changed);
+    for(i = gray_start[v + 1]; i < gray_start[v + 2]; i++)
+      gray_eval(gray_list[i], word);
+  } else if(changed) {
+    for(i = gray_start[0]; i < gray_start[1]; i++) {
+      if(gray_dep[gray_list[i]] & changed) gray_eval(gray_list[i], word);
+    }
+  }
+
+  gray_word = word;
+}
+
+/* evaluate 'nwords' words starting at 'word' into 'out', like
+ * evaluate_range(). The range is split into aligned blocks whose size is a
+ * power of two, and each block is walked in Gray code order so that only one
+ * variable changes from one word to the next; the results are put back in
+ * order in 'out' */
+static void gray_range(uint64_t word, uint64_t nwords, uint64_t *out) {
+  uint64_t end = word + nwords;
+  uint64_t size, j, w;
+
+  while(word < end) {
+    for(size = 1; !(word & size) && word + 2 * size <= end; size *= 2)
+      ;
+
+    for(j = 0; j < size; j++) {
+      w = word ^ j ^ (j >> 1);
+      gray_update(w);
+      out[w - (end - nwords)] = gray_val[dag_root];
+    }
+
+    word += size;
+  }
+}
+
+/* evaluate 'nwords' words starting at 'word' into 'out', like
+ * evaluate_range(), using the given mode. fn is the compiled code for the jit
+ * modes */
+static void evaluate_chunk(int m, JitFn fn, uint64_t word, uint64_t nwords,
+                           uint64_t *out) {
+  uint64_t j, k, r;
+
+  switch(m) {
+    case MODE_CODE:
+      for(j = 0; j < nwords; j++) out[j] = run_code(word + j);
+      break;
+
+    case MODE_GRAY:
+      gray_range(word, nwords, out);
+      break;
+
+    case MODE_JIT:
+      for(j = 0; j < nwords; j++) out[j] = fn(word + j);
+      break;
+
+    case MODE_JITROW:
+      for(j = 0; j < nwords; j++) {
+        for(r = 0, k = 0; k < 64; k++)
+          r |= (fn(((word + j) << 6) | k) & 1) << k;
+        out[j] = r;
+      }
+      break;
+
+    default:
+      evaluate_range(word, nwords, out);
+      break;
+  }
+}
+
+/* reduced ordered BDDs, with variable i at level i. An edge is a node index
+ * shifted left by one, with the low bit set if the function is complemented.
+ * Node 0 is the terminal, so edge 0 is true and edge 1 is false. The hi edge
+ * of a node is never complemented, which keeps the representation canonical */
+typedef uint32_t Bdd;
+
+#define BDD_TRUE  0
+#define BDD_FALSE 1
+#define BDD_NONE  0xffffffffu
+
+/* var of the terminal node, which is below every variable, and of free
+ * nodes */
+#define BDD_TERMINAL 0xfffffffeu
+#define BDD_FREE     0xffffffffu
+
+typedef struct BddNode {
+  uint32_t var;
+  Bdd lo, hi;
+  uint32_t next;/* next node in the same unique table chain or free list */
+} BddNode;
+
+/* computed table entry, caching the result of an operation */
+typedef struct BddCache {
+  uint32_t op;
+  Bdd a, b, r;
+} BddCache;
+
+enum bdd_op { BDD_AND = 1, BDD_XOR, BDD_RESTRICT };
+
+/* maximum number of BDD nodes */
+static uint32_t bdd_limit = 1 << 24;
+
+static struct {
+  BddNode *node;
+  uint32_t size;/* nodes allocated */
+  uint32_t top;/* nodes ever used */
+  uint32_t used;/* nodes in use */
+  uint32_t free;/* head of the free list, or 0 */
+  uint32_t *bucket;/* unique table, with size buckets */
+  BddCache *cache;/* computed table, with size / 4 entries */
+  int full;/* set if an operation ran out of nodes */
+} bdd;
+
+#define BDD_NODE(e) (bdd.node + ((e) >> 1))
+
+static uint32_t bdd_hashval(uint32_t var, Bdd lo, Bdd hi) {
+  return (var * 0x9e3779b1u ^ lo * 0x85ebca6bu ^ hi * 0xc2b2ae35u)
+         & (bdd.size - 1);
+}
+
+/* rebuild the unique table and empty the computed table */
+static void bdd_rehash(void) {
+  uint32_t i, h;
+
+  memset(bdd.bucket, 0, bdd.size * sizeof(uint32_t));
+  memset(bdd.cache, 0, bdd.size / 4 * sizeof(BddCache));
+
+  for(i = 1; i < bdd.top; i++) {
+    if(bdd.node[i].var == BDD_FREE) continue;
+    h = bdd_hashval(bdd.node[i].var, bdd.node[i].lo, bdd.node[i].hi);
+    bdd.node[i].next = bdd.bucket[h];
+    bdd.bucket[h] = i;
+  }
+}
+
+/* resize the tables to hold 'size' nodes, a power of two */
+static void bdd_resize(uint32_t size) {
+  bdd.node = realloc(bdd.node, size * sizeof(BddNode));
+  bdd.bucket = realloc(bdd.bucket, size * sizeof(uint32_t));
+  bdd.cache = realloc(bdd.cache, size / 4 * sizeof(BddCache));
+  if(!bdd.node || !bdd.bucket || !bdd.cache) die("error: out of memory\n");
+  bdd.size = size;
+  bdd_rehash();
+}
+
+/* throw away all nodes, ready for a new expression */
+static void bdd_reset(void) {
+  if(!bdd.size) bdd_resize(1 << 12);
+
+  bdd.node[0].var = BDD_TERMINAL;
+  bdd.top = 1;
+  bdd.used = 1;
+  bdd.free = 0;
+  bdd.full = 0;
+  bdd_rehash();
+}
+
+static void bdd_mark(Bdd e) {
+  BddNode *n = BDD_NODE(e);
+
+  /* the top bit of next marks a node as reachable */
+  if((e >> 1) == 0 || (n->next & 0x80000000u)) return;
+  n->next |= 0x80000000u;
+  bdd_mark(n->lo);
+  bdd_mark(n->hi);
+}
+
+/* free every node that can't be reached from the given roots, which may
+ * include BDD_NONE entries */
+static void bdd_gc(const Bdd *root, int nroots) {
+  uint32_t i;
+
+  for(i = 0; i < nroots; i++) {
+    if(root[i] != BDD_NONE) bdd_mark(root[i]);
+  }
+
+  bdd.free = 0;
+  bdd.used = 1;
+  for(i = bdd.top - 1; i > 0; i--) {
+    if(bdd.node[i].var != BDD_FREE && (bdd.node[i].next & 0x80000000u)) {
+      bdd.used++;
+    } else {
+      bdd.node[i].var = BDD_FREE;
+      bdd.node[i].next = bdd.free;
+      bdd.free = i;
+    }
+  }
+
+  bdd_rehash();
+}
+
+/* return the edge for the node (var ? hi : lo), creating it if necessary.
+ * Sets bdd.full if there is no room for it */
+static Bdd bdd_mk(uint32_t var, Bdd lo, Bdd hi) {
+  BddNode *n;
+  uint32_t h, i;
+
+  if(lo == hi) return lo;
+  if(hi & 1) return bdd_mk(var, lo ^ 1, hi ^ 1) ^ 1;
+
+  h = bdd_hashval(var, lo, hi);
+  for(i = bdd.bucket[h]; i; i = bdd.node[i].next) {
+    n = bdd.node + i;
+    if(n->var == var && n->lo == lo && n->hi == hi) return i << 1;
+  }
+
+  if(bdd.free) {
+    i = bdd.free;
+    bdd.free = bdd.node[i].next;
+  } else if(bdd.top < bdd.size) {
+    i = bdd.top++;
+  } else {
+    /* the caller will collect garbage or grow the table and try again */
+    bdd.full = 1;
+    return BDD_TRUE;
+  }
+
+  n = bdd.node + i;
+  n->var = var;
+  n->lo = lo;
+  n->hi = hi;
+  n->next = bdd.bucket[h];
+  bdd.bucket[h] = i;
+  bdd.used++;
+
+  return i << 1;
+}
+
+/* the cofactors of e with respect to var, which must not be below the top
+ * variable of e */
+static Bdd bdd_lo(Bdd e, uint32_t var) {
+  BddNode *n = BDD_NODE(e);
+  return (n->var == var) ? n->lo ^ (e & 1) : e;
+}
+
+static Bdd bdd_hi(Bdd e, uint32_t var) {
+  BddNode *n = BDD_NODE(e);
+  return (n->var == var) ? n->hi ^ (e & 1) : e;
+}
+
+/* return the cache entry for the given operation */
+static BddCache *bdd_cached(uint32_t op, Bdd a, Bdd b) {
+  return bdd.cache + ((op * 0x9e3779b1u ^ a * 0x85ebca6bu
+                       ^ b * 0xc2b2ae35u) & (bdd.size / 4 - 1));
+}
+
+static Bdd bdd_and(Bdd a, Bdd b) {
+  BddCache *c;
+  uint32_t var;
+  Bdd lo, hi, t;
+
+  if(a > b) {
+    t = a;
+    a = b;
+    b = t;
+  }
+
+  if(a == BDD_TRUE) return b;
+  if(a == BDD_FALSE || (a ^ b) == 1) return BDD_FALSE;
+  if(a == b) return a;
+
+  c = bdd_cached(BDD_AND, a, b);
+  if(c->op == BDD_AND && c->a == a && c->b == b) return c->r;
+
+  var = BDD_NODE(a)->var < BDD_NODE(b)->var ? BDD_NODE(a)->var
+                                              : BDD_NODE(b)->var;
+  lo = bdd_and(bdd_lo(a, var), bdd_lo(b, var));
+  if(bdd.full) return BDD_TRUE;
+  hi = bdd_and(bdd_hi(a, var), bdd_hi(b, var));
+  if(bdd.full) return BDD_TRUE;
+  t = bdd_mk(var, lo, hi);
+  if(bdd.full) return BDD_TRUE;
+
+  c->op = BDD_AND;
+  c->a = a;
+  c->b = b;
+  c->r = t;
+  return t;
+}
+
+static Bdd bdd_xor(Bdd a, Bdd b) {
+  BddCache *c;
+  uint32_t var;
+  Bdd lo, hi, t;
+  Bdd neg = (a ^ b) & 1;
+
+  /* complements come out of xor, so only work on plain functions */
+  a &= ~1u;
+  b &= ~1u;
+  if(a > b) {
+    t = a;
+    a = b;
+    b = t;
+  }
+
+  if(a == b) return BDD_FALSE ^ neg;
+  if(a == BDD_TRUE) return b ^ 1 ^ neg;
+
+  c = bdd_cached(BDD_XOR, a, b);
+  if(c->op == BDD_XOR && c->a == a && c->b == b) return c->r ^ neg;
+
+  var = BDD_NODE(a)->var < BDD_NODE(b)->var ? BDD_NODE(a)->var
+                                              : BDD_NODE(b)->var;
+  lo = bdd_xor(bdd_lo(a, var), bdd_lo(b, var));
+  if(bdd.full) return BDD_TRUE;
+  hi = bdd_xor(bdd_hi(a, var), bdd_hi(b, var));
+  if(bdd.full) return BDD_TRUE;
+  t = bdd_mk(var, lo, hi);
+  if(bdd.full) return BDD_TRUE;
+
+  c->op = BDD_XOR;
+  c->a = a;
+  c->b = b;
+  c->r = t;
+  return t ^ neg;
+}
+
+/* return the cofactor of e with variable var set to val */
+static Bdd bdd_restrict(Bdd e, uint32_t var, int val) {
+  BddCache *c;
+  BddNode *n = BDD_NODE(e);
+  Bdd lo, hi, t;
+
+  if(n->var > var) return e;
+  if(n->var == var) return val ? bdd_hi(e, var) : bdd_lo(e, var);
+
+  c = bdd_cached(BDD_RESTRICT, e & ~1u, var * 2 + val);
+  if(c->op == BDD_RESTRICT && c->a == (e & ~1u) && c->b == var * 2 + val)
+    return c->r ^ (e & 1);
+
+  lo = bdd_restrict(n->lo, var, val);
+  if(bdd.full) return BDD_TRUE;
+  hi = bdd_restrict(n->hi, var, val);
+  if(bdd.full) return BDD_TRUE;
+  t = bdd_mk(n->var, lo, hi);
+  if(bdd.full) return BDD_TRUE;
+
+  c->op = BDD_RESTRICT;
+  c->a = e & ~1u;
+  c->b = var * 2 + val;
+  c->r = t;
+  return t ^ (e & 1);
+}
+
+/* apply a DAG operation (I_NOT or an enum oper) to BDDs a and b */
+static Bdd bdd_apply(int op, Bdd a, Bdd b) {
+  switch(op) {
+    case I_NOT:   return a ^ 1;
+    case OP_OR:   return bdd_and(a ^ 1, b ^ 1) ^ 1;
+    case OP_AND:  return bdd_and(a, b);
+    case OP_XOR:  return bdd_xor(a, b);
+    case OP_NAND: return bdd_and(a, b) ^ 1;
+    case OP_NOR:  return bdd_and(a ^ 1, b ^ 1);
+    case OP_IMP:  return bdd_and(a, b ^ 1) ^ 1;
+    case OP_EQU:  return bdd_xor(a, b) ^ 1;
+  }
+  return BDD_NONE;
+}
+
+/* make room after an operation ran out of nodes, by collecting garbage and
+ * growing the tables if they are still more than half full. If the same
+ * operation runs out again, the tables are always grown. Return -1 if they
+ * are already at bdd_limit by then */
+static int bdd_make_room(const Bdd *root, int nroots, int tries) {
+  if(tries && bdd.size >= bdd_limit) return -1;
+
+  bdd.full = 0;
+  bdd_gc(root, nroots);
+
+  if((tries || bdd.used > bdd.size / 2) && bdd.size < bdd_limit)
+    bdd_resize(bdd.size * 2);
+
+  return 0;
+}
+
+/* build the BDD for the DAG made by compile() into *root. Return -1 if it
+ * needs more than bdd_limit nodes */
+static int bdd_build(Bdd *root) {
+  static Bdd *val;
+  static int *uses;
+  static size_t val_size, uses_size;
+  Dag *d;
+  Bdd r;
+  int i, tries;
+
+  bdd_reset();
+
+  /* the BDD of each DAG node, kept until its last use so that garbage
+   * collection knows which nodes are still needed */
+  val = scratch(val, &val_size, ndag * sizeof(Bdd));
+  uses = scratch(uses, &uses_size, ndag * sizeof(int));
+  memset(uses, 0, ndag * sizeof(int));
+
+  uses[dag_root] = 1;
+  for(i = dag_root; i >= 0; i--) {
+    val[i] = BDD_NONE;
+    if(!uses[i]) continue;
+    if(dag[i].op <= I_NOT) uses[dag[i].a]++;
+    if(dag[i].op < I_NOT) uses[dag[i].b]++;
+  }
+
+  for(i = 0; i <= dag_root; i++) {
+    if(!uses[i]) continue;
+    d = dag + i;
+
+    for(tries = 0; ; tries++) {
+      switch(d->op) {
+        case I_CONST: r = d->a ? BDD_TRUE : BDD_FALSE;            break;
+        case I_VAR:   r = bdd_mk(d->a, BDD_FALSE, BDD_TRUE);      break;
+        default:      r = bdd_apply(d->op, val[d->a], val[d->b]); break;
+      }
+
+      if(!bdd.full) break;
+      if(bdd_make_room(val, i, tries) < 0) return -1;
+    }
+
+    val[i] = r;
+    if(d->op <= I_NOT && --uses[d->a] == 0) val[d->a] = BDD_NONE;
+    if(d->op < I_NOT && --uses[d->b] == 0) val[d->b] = BDD_NONE;
+  }
+
+  *root = val[dag_root];
+
+  return 0;
+}
+
+/* return the cofactor of root with var set to val, like bdd_restrict(), or
+ * BDD_NONE if it needs more than bdd_limit nodes */
+static Bdd bdd_cofactor(Bdd root, uint32_t var, int val) {
+  Bdd r;
+  int tries;
+
+  for(tries = 0; ; tries++) {
+    r = bdd_restrict(root, var, val);
+    if(!bdd.full) return r;
+    if(bdd_make_room(&root, 1, tries) < 0) return BDD_NONE;
+  }
+}
+
+/* arbitrary-precision unsigned integers for counting rows, as bn_len 32-bit
+ * limbs, least significant first */
+static int bn_len;
+
+/* r = 2^k */
+static void bn_pow2(uint32_t *r, uint32_t k) {
+  memset(r, 0, bn_len * sizeof(uint32_t));
+  r[k / 32] = (uint32_t)1 << (k % 32);
+}
+
+/* r = a << k, where r and a may be the same */
+static void bn_shl(uint32_t *r, const uint32_t *a, uint32_t k) {
+  int i;
+  int w = k / 32, s = k % 32;
+
+  for(i = bn_len - 1; i >= 0; i--) {
+    r[i] = (i >= w) ? a[i - w] << s : 0;
+    if(s && i > w) r[i] |= a[i - w - 1] >> (32 - s);
+  }
+}
+
+/* r = a >> k, where r and a may be the same */
+static void bn_shr(uint32_t *r, const uint32_t *a, uint32_t k) {
+  int i;
+  int w = k / 32, s = k % 32;
+
+  for(i = 0; i < bn_len; i++) {
+    r[i] = (i + w < bn_len) ? a[i + w] >> s : 0;
+    if(s && i + w + 1 < bn_len) r[i] |= a[i + w + 1] << (32 - s);
+  }
+}
+
+/* r = a + b, where r may be a or b */
+static void bn_add(uint32_t *r, const uint32_t *a, const uint32_t *b) {
+  uint64_t carry = 0;
+  int i;
+
+  for(i = 0; i < bn_len; i++) {
+    carry += (uint64_t)a[i] + b[i];
+    r[i] = carry;
+    carry >>= 32;
+  }
+}
+
+/* r = a - b, where a >= b and r may be a or b */
+static void bn_sub(uint32_t *r, const uint32_t *a, const uint32_t *b) {
+  int64_t borrow = 0;
+  int i;
+
+  for(i = 0; i < bn_len; i++) {
+    borrow += (int64_t)a[i] - b[i];
+    r[i] = borrow;
+    borrow = (borrow < 0) ? -1 : 0;
+  }
+}
+
+/* print a in decimal */
+static void bn_print(const uint32_t *a) {
+  static uint32_t *t;
+  static char *digits;
+  static size_t t_size, digits_size;
+  uint64_t rem;
+  int i, nonzero;
+  char *p;
+
+  t = scratch(t, &t_size, bn_len * sizeof(uint32_t));
+  digits = scratch(digits, &digits_size, bn_len * 10 + 1);
+  memcpy(t, a, bn_len * sizeof(uint32_t));
+  p = digits + bn_len * 10;
+  *p = '\0';
+
+  do {
+    /* divide by 10^9, leaving the remainder as the next nine digits */
+    rem = 0;
+    nonzero = 0;
+    for(i = bn_len - 1; i >= 0; i--) {
+      rem = (rem << 32) | t[i];
+      t[i] = rem / 1000000000;
+      rem %= 1000000000;
+      if(t[i]) nonzero = 1;
+    }
+    for(i = 0; i < 9 && (nonzero || rem || i == 0); i++) {
+      *--p = '0' + rem % 10;
+      rem /= 10;
+    }
+  } while(nonzero);
+
+  fputs(p, stdout);
+}
+
+/* order BDD node numbers by decreasing variable, terminal first */
+static int bdd_cmp_var(const void *a, const void *b) {
+  uint32_t va = bdd.node[*(const uint32_t *)a].var;
+  uint32_t vb = bdd.node[*(const uint32_t *)b].var;
+
+  return (va < vb) - (va > vb);
+}
+
+/* limbs needed for a count over the variables var..num_vars-1 */
+static int bn_limbs(uint32_t var) {
+  return (num_vars - var) / 32 + 2;
+}
+
+/* the top variable of e, or num_vars for a terminal */
+static uint32_t bdd_top(Bdd e) {
+  BddNode *n = BDD_NODE(e);
+
+  return (n->var == BDD_TERMINAL) ? num_vars : n->var;
+}
+
+/* set r to the number of assignments to variables var..num_vars-1 for which e
+ * is true, given the counts in val of the nodes numbered by idx. Each count
+ * only has the limbs it needs. var must not be below the top variable of e */
+static void bdd_count_edge(uint32_t *r, Bdd e, uint32_t var,
+                           const uint32_t *idx, uint32_t **val) {
+  uint32_t top = bdd_top(e);
+  static uint32_t *all;
+  static size_t all_size;
+
+  memset(r, 0, bn_len * sizeof(uint32_t));
+  memcpy(r, val[idx[e >> 1]], bn_limbs(top) * sizeof(uint32_t));
+  bn_shl(r, r, top - var);
+
+  if(e & 1) {
+    all = scratch(all, &all_size, bn_len * sizeof(uint32_t));
+    bn_pow2(all, num_vars - var);
+    bn_sub(r, all, r);
+  }
+}
+
+/* drop a reference to the count of the node numbered i, freeing it after
+ * the last one */
+static void bdd_count_unref(uint32_t i, uint32_t *refs, uint32_t **val) {
+  if(--refs[i] == 0) {
+    free(val[i]);
+    val[i] = NULL;
+  }
+}
+
+/* set r to the number of rows for which 'root' is true, and return the number
+ * of nodes it has, or -1 if there isn't the memory to count them. bn_len must
+ * allow for 2^num_vars */
+static int bdd_count(uint32_t *r, Bdd root) {
+  static uint32_t *idx, *list, *refs, **val;
+  static size_t idx_size, list_size, refs_size, val_size;
+  static uint32_t *lo, *hi;
+  static size_t lo_size, hi_size;
+  uint32_t n = 0, i, c;
+  BddNode *node;
+  int fail = 0;
+
+  lo = scratch(lo, &lo_size, bn_len * sizeof(uint32_t));
+  hi = scratch(hi, &hi_size, bn_len * sizeof(uint32_t));
+  idx = scratch(idx, &idx_size, bdd.top * sizeof(uint32_t));
+  list = scratch(list, &list_size, bdd.top * sizeof(uint32_t));
+  for(i = 0; i < bdd.top; i++) idx[i] = BDD_NONE;
+
+  /* find the reachable nodes */
+  list[n++] = root >> 1;
+  idx[root >> 1] = 0;
+  for(i = 0; i < n; i++) {
+    if(list[i] == 0) continue;
+    c = bdd.node[list[i]].lo >> 1;
+    if(idx[c] == BDD_NONE) idx[list[n++] = c] = 0;
+    c = bdd.node[list[i]].hi >> 1;
+    if(idx[c] == BDD_NONE) idx[list[n++] = c] = 0;
+  }
+
+  /* count from the bottom up, so that each node's children are done first.
+   * Each count is over the variables from the node's own onwards, and is
+   * freed once the nodes that use it are done, so a long chain of nodes
+   * only has a few counts at a time */
+  qsort(list, n, sizeof(uint32_t), bdd_cmp_var);
+  refs = scratch(refs, &refs_size, n * sizeof(uint32_t));
+  val = scratch(val, &val_size, n * sizeof(uint32_t *));
+  memset(refs, 0, n * sizeof(uint32_t));
+  for(i = 0; i < n; i++) {
+    idx[list[i]] = i;
+    val[i] = NULL;
+  }
+  refs[idx[root >> 1]]++;
+  for(i = 0; i < n; i++) {
+    if(list[i] == 0) continue;
+    refs[idx[bdd.node[list[i]].lo >> 1]]++;
+    refs[idx[bdd.node[list[i]].hi >> 1]]++;
+  }
+
+  for(i = 0; i < n && !fail; i++) {
+    node = bdd.node + list[i];
+    c = bdd_top(list[i] << 1);
+
+    if(list[i] == 0) {
+      bn_pow2(hi, 0);
+    } else {
+      bdd_count_edge(lo, node->lo, node->var + 1, idx, val);
+      bdd_count_edge(hi, node->hi, node->var + 1, idx, val);
+      bn_add(hi, hi, lo);
+      bdd_count_unref(idx[node->lo >> 1], refs, val);
+      bdd_count_unref(idx[node->hi >> 1], refs, val);
+    }
+
+    if(!(val[i] = malloc(bn_limbs(c) * sizeof(uint32_t)))) fail = 1;
+    else memcpy(val[i], hi, bn_limbs(c) * sizeof(uint32_t));
+  }
+
+  if(!fail) {
+    bdd_count_edge(r, root, 0, idx, val);
+    bdd_count_unref(idx[root >> 1], refs, val);
+  }
+
+  /* after a failure, free the counts still waiting for their parents */
+  for(i = 0; fail && i < n; i++) free(val[i]);
+
+  return fail ? -1 : (int)n;
+}
+
+/* the table being printed, shared by the worker threads */
+static struct {
+  int m;/* evaluation mode */
+  JitFn fn;/* compiled code for the jit modes */
+  uint64_t last;/* index of the first row, and number of rows minus one */
+  uint64_t first, final;/* first and last positions to print */
+  uint64_t chunk;/* words evaluated at once */
+  uint64_t unit;/* rows formatted at once, a multiple of 64 */
+  char *tmpl;/* a formatted row with every variable false */
+  int *col;/* offset of each variable's column in a row */
+  uint64_t cols;/* bits of a row's index that have columns */
+  const char *ft;/* the characters for false and true */
+  size_t row_len;/* bytes in one formatted row */
+  size_t unit_size;/* bytes needed for one formatted unit */
+} table;
+
+/* most bytes in a unit, unless one group of 64 rows is bigger. Units are
+ * normally a multiple of the chunk, but very long rows make them smaller */
+#define UNIT_SIZE_MAX (64 << 20)
+
+/* set up the evaluation mode for the compiled expression, compiling it to
+ * native code if needed, and the number of words evaluated at once. Returns
+ * the size of the native code to pass to jit_free() */
+static size_t table_engine(void) {
+  size_t fn_size = 0;
+
+  /* compile to native code, falling back to the interpreter if we can't */
+  table.m = mode;
+  table.fn = NULL;
+  if(table.m == MODE_JIT || table.m == MODE_JITROW) {
+    if(!(table.fn = jit_compile(table.m == MODE_JIT, &fn_size)))
+      table.m = MODE_CODE;
+  }
+
+  if(table.m == MODE_GRAY) gray_prepare();
+
+  table.chunk = (table.m == MODE_TABLE) ? table_tile()
+              : (table.m == MODE_GRAY) ? GRAY_WORDS : BLOCK_WORDS;
+
+  return fn_size;
+}
+
+/* return the index of the row printed in position p */
+static uint64_t row_at(uint64_t p) {
+  if(order == ORDER_GRAY) return table.last ^ p ^ (p >> 1);
+  return table.last - p;
+}
+
+/* a table written with -B starts with this header, followed by the names of
+ * the variables, each ending with a NUL, and zeros up to data_offset. Then
+ * come the results as little-endian 64-bit words: bit i of the data is the
+ * result for row i, which is the row where variable b is true if bit b of i is
+ * set. The data is padded with zeros to a multiple of 64 bytes, and the tables
+ * for several expressions follow one another */
+typedef struct BinHeader {
+  char magic[8];/* BIN_MAGIC */
+  uint32_t version;/* BIN_VERSION */
+  uint32_t vars;/* number of variables */
+  uint32_t order;/* ORDER_CLASSIC or ORDER_GRAY, for printing the rows */
+  uint32_t data_offset;/* start of the data, a multiple of 64 */
+  uint64_t data_size;/* bytes of data */
+} BinHeader;
+
+#define BIN_MAGIC   "ttgen\0tt"
+#define BIN_VERSION 1
+#define BIN_ALIGN   64
+
+/* number of 64-bit words of results in the table */
+static uint64_t table_words(void) {
+  return (num_vars > 6) ? (uint64_t)1 << (num_vars - 6) : 1;
+}
+
+/* evaluate the words of unit k of a binary table into 'out', returning the
+ * number of bytes. Units are whole chunks, so there is always room to evaluate
+ * a whole chunk even at the end of the table */
+static size_t format_binary(uint64_t k, char *out) {
+  uint64_t *o = (uint64_t *)out;
+  uint64_t w, n, end;
+
+  end = (k + 1) * (table.unit / 64);
+  if(end > table_words()) end = table_words();
+
+  for(w = k * (table.unit / 64); w < end; w += n) {
+    n = (end - w < table.chunk) ? end - w : table.chunk;
+    evaluate_chunk(table.m, table.fn, w, table.chunk, o);
+    o += n;
+  }
+
+  /* clear the bits beyond the end of small tables */
+  if(num_vars < 6) ((uint64_t *)out)[0] &= ((uint64_t)1 << (1 << num_vars)) - 1;
+
+  return (char *)o - out;
+}
+
+/* the offset of the row in position p + q from row_at(p), for p a multiple of
+ * 64 and q < 64, and the inverse of that */
+static int pos_off(int q) {
+  return (order == ORDER_GRAY) ? q ^ (q >> 1) : q;
+}
+
+static int off_pos(int x) {
+  if(order == ORDER_GRAY) {
+    x ^= x >> 1;
+    x ^= x >> 2;
+    x ^= x >> 4;
+  }
+  return x;
+}
+
+/* with -l, find the runs of consecutive positions with the same result from
+ * position 'start' to 'end', into 'out' as 64-bit words: the result at start,
+ * then start, then each position where the result changes. Returns the number
+ * of bytes. A group of 64 positions whose rows all have the same result is
+ * skipped over, and the others are put in position order and their changes
+ * found with ctz, so apart from the evaluation the time grows with the number
+ * of runs rather than rows */
+static size_t format_runs(uint64_t *res, uint64_t start, uint64_t end,
+                          char *out) {
+  uint64_t *o = (uint64_t *)out;
+  uint64_t p, g, groups, base, r, x, d, all, cur = 0;
+  int rows = (table.last < 63) ? table.last + 1 : 64;
+  int q, lo, hi, n = 1;
+
+  all = (rows < 64) ? ((uint64_t)1 << rows) - 1 : ~(uint64_t)0;
+
+  /* count the groups rather than comparing p with end, which can be the last
+   * position of a 64 variable table */
+  p = start & ~(uint64_t)63;
+  groups = (end - p) / 64 + 1;
+  for(g = 0; g < groups; g++, p += 64) {
+    base = row_at(p);
+
+    if((p & (64 * table.chunk - 1)) == 0 || p + (start & 63) == start)
+      evaluate_chunk(table.m, table.fn, (base >> 6) & ~(table.chunk - 1),
+                     table.chunk, res);
+
+    r = res[(base >> 6) & (table.chunk - 1)] & all;
+
+    if(r == 0 || r == all) {
+      x = r;
+    } else {
+      /* put the results in position order */
+      for(x = 0, q = 0; q < rows; q++)
+        x |= ((r >> ((base ^ pos_off(q)) & 63)) & 1) << q;
+    }
+
+    /* the positions p + lo up to p + hi - 1 are wanted. Bit q of d is set if
+     * the result at p + q differs from the one before */
+    lo = (p < start) ? start - p : 0;
+    hi = (end - p < (uint64_t)rows) ? end - p + 1 : rows;
+    d = x ^ ((x << 1) | cur);
+
+    if(p <= start) {
+      cur = (x >> lo) & 1;
+      o[0] = cur;
+      o[n++] = start;
+      lo++;
+    }
+
+    if(lo < hi) {
+      d &= (~(uint64_t)0 << lo) & (~(uint64_t)0 >> (64 - hi));
+      for(; d; d &= d - 1) o[n++] = p + __builtin_ctzll(d);
+    }
+    cur = (x >> (hi - 1)) & 1;
+  }
+
+  return n * sizeof(uint64_t);
+}
+
+/* the run being printed with -l, carried on from one unit to the next */
+static struct {
+  int cur;/* its result, or -1 before the first */
+  uint64_t start;/* its first position */
+} run;
+
+/* print a run of positions with the same result, unless -0 or -1 leave it
+ * out */
+static void print_run(uint64_t from, uint64_t to, int v) {
+  if(only < 0 || v == only)
+    printf("rows 0x%llx..0x%llx: %c\n", (unsigned long long)from,
+           (unsigned long long)to, "FT"[v]);
+}
+
+/* print the runs that end within a unit formatted by format_runs() */
+static void print_runs(const char *buf, size_t len) {
+  const uint64_t *t = (const uint64_t *)buf;
+  size_t i, n = len / sizeof(uint64_t);
+  int v;
+
+  for(i = 1; i < n; i++) {
+    /* the first position of the unit starts a run unless it carries on the
+     * last one */
+    v = (i == 1) ? (int)t[0] : !run.cur;
+    if(v == run.cur) continue;
+
+    if(run.cur >= 0) print_run(run.start, t[i] - 1, run.cur);
+    run.start = t[i];
+    run.cur = v;
+  }
+}
+
+/* evaluate and format the rows in positions k * table.unit onwards, up to the
+ * end of the unit or the table, into 'out'. Return the number of bytes.
+ *
+ * Positions are formatted 64 at a time, starting at a multiple of 64. In
+ * either order, the row in position p + q is row_at(p) ^ off(q), where off(q)
+ * is q or the Gray code of q. So only the first 64 rows are formatted from the
+ * template, and every later group of 64 is a copy of the one before with the
+ * columns of the variables that changed between them flipped.
+ *
+ * Units are aligned to table.unit from position 0, so unit k is the k'th one
+ * that table.first is in.
+ *
+ * With -0 or -1 only the rows with that result are formatted. The matching
+ * bits of each result word are turned into a mask of positions, and the rows
+ * are found from it with ctz, so words with no matches cost next to nothing */
+static size_t format_unit(uint64_t k, char *out) {
+  static __thread uint64_t *res;
+  static __thread uint64_t res_size;
+  uint64_t p, g, groups, i, base, prev = 0, diff, r, hits, start, end;
+  size_t len = table.row_len;
+  int rows = (table.last < 63) ? table.last + 1 : 64;
+  int q, b, skip, n;
+  char *o = out;
+
+  if(binary) return format_binary(k, out);
+
+  if(res_size < table.chunk) {
+    free(res);
+    if(!(res = malloc(table.chunk * sizeof(uint64_t))))
+      die("error: out of memory\n");
+    res_size = table.chunk;
+  }
 
-enum type { UNKNOWN=0, VARIABLE, OPERATOR, LPAREN, RPAREN, NOT, SLASHVARS };
-enum oper { OP_OR, OP_AND, OP_XOR, OP_NAND, OP_NOR, OP_IMP, OP_EQU };
+  /* the positions in this unit that are printed */
+  k += table.first / table.unit;
+  start = k * table.unit;
+  end = start + table.unit - 1;
+  if(start < table.first) start = table.first;
+  if(end > table.final) end = table.final;
+  skip = start & 63;
+
+  if(rle) return format_runs(res, start, end, out);
+
+  /* as in format_runs(), end can be the last position there is */
+  p = start & ~(uint64_t)63;
+  groups = (end - p) / 64 + 1;
+  for(g = 0; g < groups; g++, p += 64) {
+    base = row_at(p);
+
+    /* evaluate a chunk of rows at a time, whenever we enter a new chunk. In
+     * either order, each aligned chunk of positions covers one aligned chunk
+     * of words */
+    if((p & (64 * table.chunk - 1)) == 0 || p + skip == start)
+      evaluate_chunk(table.m, table.fn, (base >> 6) & ~(table.chunk - 1),
+                     table.chunk, res);
+
+    /* rows in this group to print, apart from the first 'skip' */
+    n = (end - p < (uint64_t)rows) ? end - p + 1 : rows;
+
+    r = res[(base >> 6) & (table.chunk - 1)];
+
+    if(only >= 0) {
+      if(!only) r = ~r;
+      if(rows < 64) r &= ((uint64_t)1 << rows) - 1;
+
+      for(hits = 0; r; r &= r - 1)
+        hits |= (uint64_t)1 << off_pos((__builtin_ctzll(r) ^ base) & 63);
+      if(p + skip == start) hits &= ~(uint64_t)0 << skip;
+      if(n < 64) hits &= ((uint64_t)1 << n) - 1;
+
+      for(; hits; hits &= hits - 1) {
+        i = base ^ pos_off(__builtin_ctzll(hits));
+        memcpy(o, table.tmpl, len);
+        for(i &= table.cols; i; i &= i - 1)
+          o[table.col[__builtin_ctzll(i)]] = table.ft[1];
+        o[len - 2] = table.ft[only];
+        o += len;
+      }
+      continue;
+    }
 
-typedef struct Node {
-  char type;/* UNKNOWN, VARIABLE, OPERATOR, or NOT */
-  int id;/* variable or operator index */
-} Node;
+    if(o == out) {
+      for(q = 0; q < rows; q++) {
+        memcpy(o + q * len, table.tmpl, len);
+        i = (base ^ pos_off(q)) & table.cols;
+        for(; i; i &= i - 1)
+          o[q * len + table.col[__builtin_ctzll(i)]] = table.ft[1];
+      }
+    } else {
+      memcpy(o, o - 64 * len, 64 * len);
+      for(diff = (base ^ prev) & table.cols; diff; diff &= diff - 1) {
+        b = __builtin_ctzll(diff);
+        for(q = 0; q < 64; q++)
+          o[q * len + table.col[b]] ^= table.ft[0] ^ table.ft[1];
+      }
+    }
 
-typedef struct Token {
-  char *text;/* the actual text of the token */
-  char type;/* VARIABLE, OPERATOR, LPAREN, RPAREN, or NOT */
-} Token;
+    /* patch in the results */
+    for(q = 0; q < rows; q++) {
+      i = base ^ pos_off(q);
+      o[q * len + len - 2] = table.ft[(r >> (i & 63)) & 1];
+    }
 
-/* array of operator names */
-static char *operator[] =
-  { "OR", "AND", "XOR", "NAND", "NOR", "IMP", "EQU", NULL };
-static char *short_op[] =
-  { "|", "&", "^", "", "", "->", "=", NULL };
+    o += n * len;
+    prev = base;
+  }
 
-#define STACK_MAX 128
+  /* drop the rows before the start of the range, which were only formatted so
+   * that the later groups could be copied from them */
+  if(only < 0 && skip) {
+    memmove(out, out + skip * len, (o - out) - skip * len);
+    o -= skip * len;
+  }
 
-/* expression nodes */
-Node *node;
-int np;
+  return o - out;
+}
 
-/* array of variable names, for looking up id's
- * unused entries are NULL */
-#define VAR_MAX 64
-static char *variable[VAR_MAX];
-static int num_vars;
+/* write all of buf to stdout, bypassing stdio */
+static void write_out(const char *buf, size_t len) {
+  ssize_t n;
 
-/* store raw text input expressions */
-static char input[1024];
-static char *input_ptr;
+  while(len > 0) {
+    if((n = write(STDOUT_FILENO, buf, len)) < 0) {
+      if(errno == EINTR) continue;
+      die("error: write failed: %s\n", strerror(errno));
+    }
+    buf += n;
+    len -= n;
+  }
+}
 
-/* print the given message to stderr and exit with code 1 */
-static void die(const char *fmt, ...) {
-  va_list args;
+/* with OUT_SPLICE, when stdout is a pipe, the pages of formatted rows are
+ * handed to the pipe with vmsplice() rather than copied into it by write().
+ * The pipe then refers to our pages until the reader has read them, so the
+ * buffers are allocated whole pages, with a page in front recording how much
+ * had been spliced after each one. The pipe holds at most pipe_size bytes, so
+ * once that much more has been spliced, or less is left unread in the pipe
+ * than has been spliced since, the reader is done with the buffer. Otherwise
+ * out_reuse() maps fresh pages in its place, and the pipe keeps the old ones */
+typedef struct OutMeta {
+  size_t size;/* bytes mapped after the meta page */
+  uint64_t end;/* splicer.total just after it was spliced, or 0 */
+} OutMeta;
+
+static struct {
+  int on;/* set when stdout is a pipe we can splice to */
+  size_t page;
+  size_t pipe_size;
+  uint64_t total;/* bytes spliced so far */
+} splicer;
+
+#define OUT_META(buf) ((OutMeta *)((buf) - splicer.page))
+
+/* allocate an output buffer of at least 'size' bytes */
+static char *out_alloc(size_t size) {
+  char *p;
+
+  if(!splicer.on) {
+    if(!(p = malloc(size))) die("error: out of memory\n");
+    return p;
+  }
 
-  va_start(args, fmt);
-  vfprintf(stderr, fmt, args);
-  va_end(args);
+  size = (size + splicer.page - 1) & ~(splicer.page - 1);
+  p = mmap(NULL, size + splicer.page, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED) die("error: out of memory\n");
 
-  exit(1);
+  p += splicer.page;
+  OUT_META(p)->size = size;
+  OUT_META(p)->end = 0;
+  return p;
+}
+
+static void out_free(char *buf) {
+  if(!buf) return;
+  if(!splicer.on) free(buf);
+  else munmap(buf - splicer.page, OUT_META(buf)->size + splicer.page);
+}
+
+#ifdef __linux__
+/* make sure an output buffer can be written again */
+static void out_reuse(char *buf) {
+  OutMeta *m;
+  uint64_t since;
+  int unread;
+
+  if(!splicer.on || !(m = OUT_META(buf))->end) return;
+
+  since = __atomic_load_n(&splicer.total, __ATOMIC_ACQUIRE) - m->end;
+  if(since < splicer.pipe_size
+     && (ioctl(STDOUT_FILENO, FIONREAD, &unread) < 0
+         || (uint64_t)unread > since)) {
+    if(mmap(buf, m->size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+      die("error: out of memory\n");
+  }
+  m->end = 0;
+}
+
+/* write out a buffer from out_alloc() */
+static void out_write(char *buf, size_t len) {
+  struct iovec iov;
+  ssize_t n;
+
+  if(!splicer.on) {
+    write_out(buf, len);
+    return;
+  }
+
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  while(iov.iov_len > 0) {
+    if((n = vmsplice(STDOUT_FILENO, &iov, 1, 0)) < 0) {
+      if(errno == EINTR) continue;
+      die("error: vmsplice failed: %s\n", strerror(errno));
+    }
+    iov.iov_base = (char *)iov.iov_base + n;
+    iov.iov_len -= n;
+  }
+
+  OUT_META(buf)->end = __atomic_add_fetch(&splicer.total, len,
+                                          __ATOMIC_RELEASE);
+}
+
+/* splice to stdout from now on if it is a pipe */
+static void splice_start(void) {
+  struct stat st;
+  int size;
+
+  if(fstat(STDOUT_FILENO, &st) < 0 || !S_ISFIFO(st.st_mode)) return;
+
+  /* a bigger pipe means fewer, bigger splices */
+  fcntl(STDOUT_FILENO, F_SETPIPE_SZ, 1 << 20);
+  if((size = fcntl(STDOUT_FILENO, F_GETPIPE_SZ)) <= 0) return;
+
+  splicer.page = sysconf(_SC_PAGESIZE);
+  splicer.pipe_size = size;
+  splicer.on = 1;
+}
+#else
+static void out_reuse(char *buf) {
+}
+
+static void out_write(char *buf, size_t len) {
+  write_out(buf, len);
+}
+
+static void splice_start(void) {
+}
+#endif
+
+/* write out or print a formatted unit */
+static void unit_out(char *buf, size_t len) {
+  if(rle) print_runs(buf, len);
+  else out_write(buf, len);
 }
 
-/* return the variable id for the given variable name, creating if necessary */
-static int var_id(const char *var_name) {
+/* with OUT_THREAD, units are formatted into a ring of buffers which the writer
+ * thread writes out in order, so the next units are evaluated and formatted
+ * while the last ones are written. The ring bounds the memory used: when it is
+ * full, formatting waits for a buffer to be written */
+#define WRITER_BUFS 4
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t queued;/* signalled when a buffer is queued */
+  pthread_cond_t written;/* signalled when a buffer has been written */
+  int started;/* set once the thread is running */
+  char *buf[WRITER_BUFS];
+  size_t len[WRITER_BUFS];
+  size_t size;/* size of each buffer */
+  uint64_t head;/* buffers queued so far */
+  uint64_t tail;/* buffers written so far */
+} writer = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+             PTHREAD_COND_INITIALIZER };
+
+static void *writer_thread(void *arg) {
   int i;
 
-  for(i = 0; (i < VAR_MAX) && (variable[i]); i++) {
-    if(strcmp(var_name, variable[i]) == 0) return i;
+  pthread_mutex_lock(&writer.lock);
+  for(;;) {
+    while(writer.tail == writer.head)
+      pthread_cond_wait(&writer.queued, &writer.lock);
+
+    i = writer.tail % WRITER_BUFS;
+    pthread_mutex_unlock(&writer.lock);
+
+    out_write(writer.buf[i], writer.len[i]);
+
+    pthread_mutex_lock(&writer.lock);
+    writer.tail++;
+    pthread_cond_signal(&writer.written);
   }
 
-  /* TODO: handle this more gracefully */
-  if(i == VAR_MAX) die("error: maximum of %d variables\n", VAR_MAX);
+  return NULL;
+}
 
-  /* if the variable wasn't found, make it */
-  variable[i] = strdup(var_name);
-  num_vars++;
-  return i;
+/* wait until everything queued has been written */
+static void writer_sync(void) {
+  pthread_mutex_lock(&writer.lock);
+  while(writer.tail != writer.head)
+    pthread_cond_wait(&writer.written, &writer.lock);
+  pthread_mutex_unlock(&writer.lock);
 }
 
-/* return the operator id for the given name, or -1 if none */
-static int oper_id(const char *oper_name) {
+/* make sure the writer is running with buffers of at least 'size' bytes */
+static void writer_start(size_t size) {
+  pthread_t thread;
   int i;
 
-  for(i = 0; operator[i]; i++) {
-    if(strcasecmp(oper_name, operator[i]) == 0) return i;
-    if(strcmp(oper_name, short_op[i]) == 0) return i;
+  writer_sync();
+
+  if(size > writer.size) {
+    for(i = 0; i < WRITER_BUFS; i++) {
+      out_free(writer.buf[i]);
+      writer.buf[i] = out_alloc(size);
+    }
+    writer.size = size;
+  }
+
+  if(!writer.started) {
+    if(pthread_create(&thread, NULL, writer_thread, NULL) != 0)
+      die("error: can't create thread\n");
+    pthread_detach(thread);
+    writer.started = 1;
   }
+}
 
-  return -1;
+/* return the next free buffer, waiting for one to be written if need be */
+static char *writer_buf(void) {
+  char *buf;
+
+  pthread_mutex_lock(&writer.lock);
+  while(writer.head - writer.tail == WRITER_BUFS)
+    pthread_cond_wait(&writer.written, &writer.lock);
+  buf = writer.buf[writer.head % WRITER_BUFS];
+  pthread_mutex_unlock(&writer.lock);
+
+  out_reuse(buf);
+  return buf;
 }
 
-/* resets the token stream so that it is ready for another string */
-static void reset_tokstr(void) {
-  input_ptr = NULL;
+/* queue the buffer from writer_buf() to be written, with 'len' bytes in it */
+static void writer_queue(size_t len) {
+  pthread_mutex_lock(&writer.lock);
+  writer.len[writer.head % WRITER_BUFS] = len;
+  writer.head++;
+  pthread_cond_signal(&writer.queued);
+  pthread_mutex_unlock(&writer.lock);
 }
 
-/* clears the variables */
-static void clear_vars(void) {
+/* worker threads format units of the table into a ring of buffers, which
+ * print_table() writes out in order, so the main thread is the writer. Unit k
+ * goes in ring[k % nring], and is only started once unit k - nring has been
+ * written */
+typedef struct Unit {
+  char *buf;
+  size_t len;
+  int ready;/* set when buf holds the formatted unit */
+} Unit;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;/* signalled when more units may be started */
+  pthread_cond_t done;/* signalled when a unit is ready */
+  int started;/* set once the threads are running */
+  uint64_t next;/* next unit to be started */
+  uint64_t units;/* units in the table */
+  uint64_t written;/* units written out so far */
+  Unit *ring;
+  int nring;
+  size_t buf_size;/* size of each ring buffer */
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+           PTHREAD_COND_INITIALIZER };
+
+static void *worker(void *arg) {
+  Unit *u;
+  uint64_t k;
+
+  pthread_mutex_lock(&pool.lock);
+  for(;;) {
+    while(pool.next >= pool.units || pool.next >= pool.written + pool.nring)
+      pthread_cond_wait(&pool.work, &pool.lock);
+
+    k = pool.next++;
+    u = pool.ring + k % pool.nring;
+    pthread_mutex_unlock(&pool.lock);
+
+    out_reuse(u->buf);
+    u->len = format_unit(k, u->buf);
+
+    pthread_mutex_lock(&pool.lock);
+    u->ready = 1;
+    pthread_cond_broadcast(&pool.done);
+  }
+
+  return NULL;
+}
+
+/* format and write out the rows of the table with the worker threads */
+static void pool_print(uint64_t units) {
+  pthread_t thread;
+  Unit *u;
+  uint64_t k;
+  size_t size = table.unit_size;
   int i;
 
-  for(i = 0; i < num_vars; i++) {
-    free(variable[i]);
-    variable[i] = NULL;
+  pthread_mutex_lock(&pool.lock);
+
+  if(!pool.started) {
+    pool.nring = 2 * nthreads;
+    if(!(pool.ring = calloc(pool.nring, sizeof(Unit))))
+      die("error: out of memory\n");
+    for(i = 0; i < nthreads; i++) {
+      if(pthread_create(&thread, NULL, worker, NULL) != 0)
+        die("error: can't create thread\n");
+      pthread_detach(thread);
+    }
+    pool.started = 1;
   }
-  num_vars = 0;
+
+  if(size > pool.buf_size) {
+    for(i = 0; i < pool.nring; i++) {
+      out_free(pool.ring[i].buf);
+      pool.ring[i].buf = out_alloc(size);
+    }
+    pool.buf_size = size;
+  }
+
+  pool.next = 0;
+  pool.written = 0;
+  pool.units = units;
+  pthread_cond_broadcast(&pool.work);
+
+  for(k = 0; k < units; k++) {
+    u = pool.ring + k % pool.nring;
+    while(!u->ready) pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    unit_out(u->buf, u->len);
+
+    pthread_mutex_lock(&pool.lock);
+    u->ready = 0;
+    pool.written++;
+    pthread_cond_broadcast(&pool.work);
+  }
+
+  pool.units = 0;
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/* write the header of a binary table, and the variable names */
+static void write_header(void) {
+  static BinHeader *h;
+  static size_t h_size;
+  size_t size = sizeof(BinHeader);
+  char *p;
+  int b;
+
+  for(b = 0; b < num_vars; b++) size += strlen(variable[b]) + 1;
+  size = (size + BIN_ALIGN - 1) & ~(size_t)(BIN_ALIGN - 1);
+
+  h = scratch(h, &h_size, size);
+  memset(h, 0, size);
+  memcpy(h->magic, BIN_MAGIC, sizeof(h->magic));
+  h->version = BIN_VERSION;
+  h->vars = num_vars;
+  h->order = order;
+  h->data_offset = size;
+  h->data_size = table_words() * 8;
+
+  p = (char *)(h + 1);
+  for(b = 0; b < num_vars; b++) {
+    strcpy(p, variable[b]);
+    p += strlen(p) + 1;
+  }
+
+  write_out((char *)h, size);
+}
+
+/* with -o, tables whose rows all have the same size are formatted straight into
+ * the output file. It is extended to make room for the table, and that part is
+ * mapped, so the worker threads can format each unit where it goes as soon as
+ * they get to it, with no ordering or copying. Only the first and last units
+ * might format more than they return, so they go through a buffer */
+static struct {
+  char *base;/* where the table goes in the mapping */
+  uint64_t units;
+  uint64_t next;/* next unit to be formatted */
+  char *buf;/* room for the first and last units, kept for the next table */
+  size_t buf_size;
+} map;
+
+/* the offset of a unit from the start of the table in the file */
+static uint64_t unit_offset(uint64_t k) {
+  uint64_t start = (k + table.first / table.unit) * table.unit;
+
+  if(binary) return k * (table.unit / 8);
+  if(start < table.first) start = table.first;
+  return (start - table.first) * table.row_len;
 }
 
-/* return the next token available in the global string "input", or NULL if
- * the end of the string is reached. The returned token should be free'd with
- * free_token() */
-static Token *next_token(void) {
-  Token *t;
+static void *map_worker(void *arg) {
+  uint64_t k;
   size_t len;
+  char *buf;
+
+  while((k = __atomic_fetch_add(&map.next, 1, __ATOMIC_RELAXED)) < map.units) {
+    if(k == 0 || k == map.units - 1) {
+      buf = map.buf + (k ? table.unit_size : 0);
+      len = format_unit(k, buf);
+      memcpy(map.base + unit_offset(k), buf, len);
+    } else {
+      format_unit(k, map.base + unit_offset(k));
+    }
+  }
+
+  return NULL;
+}
+
+/* format the table into the output file, which is 'size' bytes from the
+ * current offset */
+static void map_print(uint64_t units, uint64_t size) {
+  int n = (nthreads > 1) ? nthreads : 1;
+  pthread_t thread[n];
+  off_t off, start;
+  char *p;
   int i;
 
-  /* starting a new string */
-  if(!input_ptr) input_ptr = input;
+  /* allocate the space now, rather than hitting a full disk while writing
+   * through the mapping */
+  off = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+  i = posix_fallocate(STDOUT_FILENO, off, size);
+  if(i == EINVAL || i == EOPNOTSUPP)
+    i = (ftruncate(STDOUT_FILENO, off + size) < 0) ? errno : 0;
+  if(i) die("error: can't extend the output file: %s\n", strerror(i));
+
+  start = off & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+  p = mmap(NULL, size + (off - start), PROT_READ | PROT_WRITE, MAP_SHARED,
+           STDOUT_FILENO, start);
+  if(p == MAP_FAILED) die("error: can't map the output file\n");
+
+  map.base = p + (off - start);
+  map.units = units;
+  map.next = 0;
+  map.buf = scratch(map.buf, &map.buf_size, 2 * table.unit_size);
+
+  for(i = 1; i < n; i++) {
+    if(pthread_create(&thread[i], NULL, map_worker, NULL) != 0)
+      die("error: can't create thread\n");
+  }
+  map_worker(NULL);
+  for(i = 1; i < n; i++) pthread_join(thread[i], NULL);
 
-  /* eat whitespace */
-  input_ptr += strspn(input_ptr, WHITESPACE);
+  munmap(p, size + (off - start));
+  lseek(STDOUT_FILENO, off + size, SEEK_SET);
+}
 
-  /* reached the end of the string? */
-  if(!*input_ptr) {
-    input_ptr = NULL;
-    return NULL;
+/* compile the expression, printing an error and returning -1 if its stack
+ * usage is wrong */
+static int compile_expr(void) {
+  int fail;
+
+  if((fail = compile()) < 0) {
+    if(fail == -2) fprintf(stderr, "error: stack underflow\n");
+    else if(fail == -3) fprintf(stderr, "error: stack not empty\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* print the header line of a table in the chosen format. Tables and bit
+ * strings list the variables, whose order gives the order of the rows, and CSV
+ * and TSV name the columns that are printed */
+static void print_header(void) {
+  char sep = (format == FMT_CSV) ? ',' : (format == FMT_TSV) ? '\t' : ' ';
+  int b;
+
+  if(format == FMT_TABLE) {
+    for(b = 0; b < num_vars; b++) printf("%s ", variable[b]);
+  } else if(format == FMT_BITS) {
+    for(b = 0; b < num_vars; b++) printf(b ? " %s" : "%s", variable[b]);
+  } else {
+    for(b = 0; b < num_vars && !result_only; b++)
+      printf("%s%c", variable[b], sep);
+    printf("result");
+  }
+  printf("\n");
+}
+
+/* set table.unit_size for table.unit. A unit of a small table only has the
+ * table's rows */
+static void unit_bytes(void) {
+  uint64_t rows = (table.unit <= table.last) ? table.unit : table.last + 1;
+
+  table.unit_size = binary ? table.unit / 8
+                  : rle ? (table.unit + 2) * sizeof(uint64_t)
+                  : rows * table.row_len;
+}
+
+/* print the truth table for the expression, returning 0 if it had an error */
+static int print_table(void) {
+  /* the buffer for rows formatted on this thread, kept for the next table */
+  static char *buf;
+  static size_t buf_size;
+  /* the row template, whose length grows with the variables' names */
+  static char *tmpl;
+  static size_t tmpl_size;
+  uint64_t k, units = 0;
+  int col[TABLE_VARS_MAX];
+  int b;
+  size_t fn_size;
+
+  if(compile_expr() < 0) return 0;
+  if(num_vars > TABLE_VARS_MAX) {
+    fprintf(stderr, "error: tables can have at most %d variables\n",
+            TABLE_VARS_MAX);
+    return 0;
   }
 
-#define RETURN_TOKEN(len, token)            \
-  do {                                      \
-    t->type = (token);                      \
-    if(!t->text) {                          \
-      t->text = malloc((len) + 1);          \
-      memcpy(t->text, input_ptr, (len));    \
-      t->text[(len)] = '\0';                \
-    }                                       \
-    input_ptr += (len);                     \
-    return t;                               \
-  } while(0)
+  if(!binary && range.from == 0) print_header();
+
+  /* lay out a row: a column for each variable unless -x leaves them out,
+   * then the result and a newline. In a table, each variable's T or F is
+   * padded to the length of its name, like printf("%-*c "), and there is an
+   * extra space before the result */
+  table.row_len = 2;
+  for(b = 0; b < num_vars && !result_only; b++) {
+    col[b] = table.row_len - 2;
+    table.row_len += (format == FMT_TABLE) ? strlen(variable[b]) + 1
+                   : (format == FMT_BITS) ? 1 : 2;
+  }
+  if(format == FMT_TABLE && !result_only) table.row_len++;
+
+  table.ft = (format == FMT_BITS) ? "01" : "FT";
+  table.cols = result_only ? 0 : ~(uint64_t)0;
+
+  tmpl = scratch(tmpl, &tmpl_size, table.row_len);
+  memset(tmpl, (format == FMT_CSV) ? ',' : (format == FMT_TSV) ? '\t' : ' ',
+         table.row_len);
+  for(b = 0; b < num_vars && !result_only; b++) tmpl[col[b]] = table.ft[0];
+  tmpl[table.row_len - 2] = table.ft[0];
+  tmpl[table.row_len - 1] = '\n';
+
+  table.tmpl = tmpl;
+  table.col = col;
 
-  t = malloc(sizeof(Token));
-  memset(t, 0, sizeof(Token));
+  /* index of the first row to be printed */
+  table.last = (num_vars < 64) ? ((uint64_t)1 << num_vars) - 1 : ~(uint64_t)0;
 
-  /* check for easy single-character tokens */
-  if(strchr("()/", *input_ptr)) {
-    /* select token type */
-    switch(*input_ptr) {
-      case '(': RETURN_TOKEN(1, LPAREN);    break;
-      case ')': RETURN_TOKEN(1, RPAREN);    break;
-      case '/': RETURN_TOKEN(1, SLASHVARS); break;
+  table.first = range.from;
+  table.final = (range.to && range.to - 1 < table.last) ? range.to - 1
+                                                         : table.last;
+
+  fn_size = table_engine();
+
+  /* format about 1M at a time, in units of no more than UNIT_SIZE_MAX */
+  for(table.unit = 64 * table.chunk; ; table.unit *= 2) {
+    unit_bytes();
+    if(table.unit_size >= (1 << 20) || table.unit > table.last) break;
+  }
+  while(table.unit > 64 && table.unit_size > UNIT_SIZE_MAX) {
+    table.unit /= 2;
+    unit_bytes();
+  }
+  if(table.first <= table.final)
+    units = table.final / table.unit - table.first / table.unit + 1;
+
+  /* the rows are written directly, after anything buffered by stdio */
+  fflush(stdout);
+  run.cur = -1;
+
+  if(binary) write_header();
+
+  if(map_out && units > 1 && only < 0 && !rle) {
+    map_print(units, binary ? table_words() * 8
+                            : (table.final - table.first + 1) * table.row_len);
+  } else if(nthreads > 1 && units > 1) {
+    pool_print(units);
+  } else if(units > 1 && out_method != OUT_WRITE && !rle) {
+    writer_start(table.unit_size);
+    for(k = 0; k < units; k++) writer_queue(format_unit(k, writer_buf()));
+    /* the rows must all be out before anything else is printed */
+    writer_sync();
+  } else if(units > 0) {
+    if(buf_size < table.unit_size) {
+      out_free(buf);
+      buf = out_alloc(table.unit_size);
+      buf_size = table.unit_size;
     }
-    return t;
+    for(k = 0; k < units; k++) {
+      out_reuse(buf);
+      unit_out(buf, format_unit(k, buf));
+    }
+  }
+
+  if(rle && run.cur >= 0) print_run(run.start, table.final, run.cur);
+  run.cur = -1;
+
+  if(binary) {
+    /* pad the data */
+    static const char zero[BIN_ALIGN];
+    write_out(zero, -(table_words() * 8) & (BIN_ALIGN - 1));
   }
 
-  /* check for a symbolic form of an operator */
-  if(!isalpha(*input_ptr)) {
-    /* special case "!" */
-    if(*input_ptr == '!') RETURN_TOKEN(1, NOT);
+  if(table.fn) jit_free(table.fn, fn_size);
+  return 1;
+}
+
+/* parse a range of positions for -R, like "a:b", "a:" or ":b" */
+static void parse_range(const char *s) {
+  char *end;
+
+  range.from = strtoull(s, &end, 0);
+  if(*end++ != ':') die("error: expected a range like \"from:to\"\n");
+  range.to = *end ? strtoull(end, &end, 0) : 0;
+  if(*end || (range.to && range.to <= range.from))
+    die("error: bad range \"%s\"\n", s);
+}
+
+/* variables given fixed values with -r */
+typedef struct Fixed {
+  char *name;
+  int val;
+} Fixed;
+
+static Fixed *fixed;
+static int nfixed;
+
+/* parse a list of assignments like "X=T,Y=F" into fixed[] */
+static void parse_fixed(char *s) {
+  char *tok, *eq;
+
+  for(tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+    if(!(eq = strchr(tok, '='))) die("error: expected \"%s=T\" or \"%s=F\"\n",
+                                     tok, tok);
+    *eq++ = '\0';
 
-    /* search for a matching operator name */
-    for(i = 0; short_op[i]; i++) {
-      /* skip operators that have no short form */
-      if(!*short_op[i]) continue;
+    if(!(fixed = realloc(fixed, (nfixed + 1) * sizeof(Fixed))))
+      die("error: out of memory\n");
+    fixed[nfixed].name = tok;
+
+    if(strcasecmp(eq, "T") == 0 || strcmp(eq, "1") == 0)
+      fixed[nfixed].val = 1;
+    else if(strcasecmp(eq, "F") == 0 || strcmp(eq, "0") == 0)
+      fixed[nfixed].val = 0;
+    else
+      die("error: \"%s\" is not T or F\n", eq);
+
+    nfixed++;
+  }
+}
 
-      if(memcmp(input_ptr, short_op[i], strlen(short_op[i])) == 0)
-        RETURN_TOKEN(strlen(short_op[i]), OPERATOR);
+/* resolve the -r assignments into val[], which is -1 for each free variable
+ * and 0 or 1 for each fixed one. Returns the number of fixed variables, or -1
+ * after printing an error */
+static int resolve_fixed(signed char *val) {
+  int nvals = 0;
+  int i, v;
+
+  memset(val, -1, num_vars);
+  for(i = 0; i < nfixed; i++) {
+    if((v = var_find(fixed[i].name, strlen(fixed[i].name))) < 0) {
+      fprintf(stderr, "error: unknown variable \"%s\"\n", fixed[i].name);
+      return -1;
     }
+    if(val[v] >= 0 && val[v] != fixed[i].val) {
+      fprintf(stderr, "error: conflicting values for \"%s\"\n", fixed[i].name);
+      return -1;
+    }
+
+    if(val[v] < 0) nvals++;
+    val[v] = fixed[i].val;
+  }
+
+  return nvals;
+}
+
+/* build the BDD for the expression with the fixed variables in val[]
+ * restricted, and count the rows where it is true into t[]. Returns the number
+ * of nodes, -1 if it needs more than bdd_limit, or -2 if there isn't the
+ * memory to count the rows */
+static int bdd_fixed_count(uint32_t *t, Bdd *root, const signed char *val,
+                           int nvals) {
+  int v;
+
+  if(bdd_build(root) < 0) return -1;
+
+  for(v = 0; v < num_vars; v++) {
+    if(val[v] >= 0 && (*root = bdd_cofactor(*root, v, val[v])) == BDD_NONE)
+      return -1;
   }
 
-  len = strspn(input_ptr, LETTER NUMBER "_'");
+  /* the cofactor doesn't depend on the fixed variables, so each row we
+   * want is counted once for every combination of their values */
+  if((v = bdd_count(t, *root)) < 0) return -2;
+  bn_shr(t, t, nvals);
+  return v;
+}
 
-  /* not a valid operator or variable name */
-  if(len == 0) {
-    RETURN_TOKEN(0, UNKNOWN);
+/* analyse the expression with a BDD, without enumerating the rows: print
+ * the number of rows for which it is true and false, and whether it is
+ * satisfiable or a tautology. If any variables are fixed with -r, only the
+ * rows where they have those values are considered */
+static void print_analysis(void) {
+  static signed char *val;
+  static uint32_t *t, *f;
+  static size_t val_size, t_size, f_size;
+  Bdd root;
+  int nodes, nvals, v;
+
+  if(compile_expr() < 0) return;
+  val = scratch(val, &val_size, num_vars + 1);
+  if((nvals = resolve_fixed(val)) < 0) return;
+
+  bn_len = num_vars / 32 + 2;
+  t = scratch(t, &t_size, bn_len * sizeof(uint32_t));
+  f = scratch(f, &f_size, bn_len * sizeof(uint32_t));
+  if((nodes = bdd_fixed_count(t, &root, val, nvals)) == -2) {
+    fprintf(stderr, "error: out of memory counting the rows\n");
+    return;
+  }
+  if(nodes < 0) {
+    fprintf(stderr, "error: more than %u BDD nodes needed\n", bdd_limit);
+    return;
   }
+  bn_pow2(f, num_vars - nvals);
+  bn_sub(f, f, t);
 
-  /* copy the word */
-  t->text = malloc(len + 1);
-  memcpy(t->text, input_ptr, len);
-  t->text[len] = '\0';
+  for(v = 0; v < num_vars; v++) printf("%s ", variable[v]);
+  printf("\n");
+
+  printf("bdd nodes: %d\n", nodes);
+  printf("true rows: ");
+  bn_print(t);
+  printf("\nfalse rows: ");
+  bn_print(f);
+  printf("\n");
 
+  printf("satisfiable: %s\n", (root != BDD_FALSE) ? "yes" : "no");
+  printf("tautology: %s\n", (root == BDD_TRUE) ? "yes" : "no");
+}
 
-  /* special-case unary operator */
-  if(strcasecmp(t->text, "NOT") == 0) {
-    RETURN_TOKEN(len, NOT);
+/* expressions with up to this many variables are counted by evaluating every
+ * row, and ones with more by building a BDD. If the BDD gets too big, we still
+ * fall back to evaluating up to COUNT_ENUM_MAX variables */
+#define COUNT_ENUM_VARS 24
+#define COUNT_ENUM_MAX  40
+
+/* a range of words counted by one thread */
+typedef struct Count {
+  uint64_t word, nwords;
+  uint64_t low;/* rows to count within each word */
+  uint64_t high_mask, high;/* words to count: (word & high_mask) == high */
+  uint64_t count;
+  uint64_t *out;/* room for the results of a chunk */
+} Count;
+
+static void *count_range(void *arg) {
+  Count *c = arg;
+  uint64_t *out = c->out;
+  uint64_t w, n, j;
+
+  for(w = c->word; w < c->word + c->nwords; w += n) {
+    n = c->word + c->nwords - w;
+    if(n > table.chunk) n = table.chunk;
+
+    /* evaluate whole chunks, like print_table(), and ignore the excess */
+    evaluate_chunk(table.m, table.fn, w, table.chunk, out);
+    for(j = 0; j < n; j++) {
+      if(((w + j) & c->high_mask) == c->high)
+        c->count += __builtin_popcountll(out[j] & c->low);
+    }
   }
 
-  /* check for operators */
-  for(i = 0; operator[i]; i++) {
-    if(strcasecmp(t->text, operator[i]) == 0) {
-      RETURN_TOKEN(len, OPERATOR);
+  return NULL;
+}
+
+/* count the rows where the expression is true, with the variables in val[]
+ * fixed, by evaluating them all 64 at a time on nthreads threads */
+static uint64_t count_rows(const signed char *val) {
+  static uint64_t *out;
+  static size_t out_size;
+  int n = (nthreads > 1) ? nthreads : 1;
+  pthread_t thread[n];
+  Count c[n];
+  uint64_t nwords, per, low, high_mask = 0, high = 0, count = 0;
+  size_t fn_size;
+  int i, v;
+
+  /* the rows within each word, and the words, that match val[] */
+  low = (num_vars < 6) ? ((uint64_t)1 << (1 << num_vars)) - 1 : ~(uint64_t)0;
+  for(v = 0; v < num_vars; v++) {
+    if(val[v] < 0) continue;
+    if(v < 6) {
+      low &= val[v] ? low_mask[v] : ~low_mask[v];
+    } else {
+      high_mask |= (uint64_t)1 << (v - 6);
+      high |= (uint64_t)val[v] << (v - 6);
     }
   }
 
-  /* only remaining possibility is a variable */
-  RETURN_TOKEN(len, VARIABLE);
+  fn_size = table_engine();
+
+  /* small tables aren't worth starting threads for, so they are counted
+   * here, like print_table() does for tables with only one unit */
+  nwords = table_words();
+  if(nwords <= n * table.chunk) n = 1;
+
+  /* the threads' buffers are kept for the next table */
+  out = scratch(out, &out_size, n * table.chunk * sizeof(uint64_t));
+
+  /* give each thread an equal share of whole chunks */
+  per = (nwords + n - 1) / n;
+  per = (per + table.chunk - 1) / table.chunk * table.chunk;
+
+  for(i = 0; i < n; i++) {
+    c[i].word = i * per;
+    c[i].nwords = (c[i].word >= nwords) ? 0
+                : (nwords - c[i].word < per) ? nwords - c[i].word : per;
+    c[i].low = low;
+    c[i].high_mask = high_mask;
+    c[i].high = high;
+    c[i].count = 0;
+    c[i].out = out + i * table.chunk;
+    if(i > 0 && pthread_create(&thread[i], NULL, count_range, &c[i]) != 0)
+      die("error: can't create thread\n");
+  }
+
+  count_range(&c[0]);
+  for(i = 0; i < n; i++) {
+    if(i > 0) pthread_join(thread[i], NULL);
+    count += c[i].count;
+  }
+
+  if(table.fn) jit_free(table.fn, fn_size);
+  return count;
 }
 
-/* free's the given token, including it's text field */
-static void free_token(Token *t) {
-  free(t->text);
-  free(t);
+/* print the number of rows where the expression is true, counting them by
+ * evaluation for small tables and with a BDD for big ones */
+static void print_count(void) {
+  static signed char *val;
+  static uint32_t *t;
+  static size_t val_size, t_size;
+  Bdd root;
+  int nvals, nodes;
+
+  if(compile_expr() < 0) return;
+  val = scratch(val, &val_size, num_vars + 1);
+  if((nvals = resolve_fixed(val)) < 0) return;
+
+  bn_len = num_vars / 32 + 2;
+  t = scratch(t, &t_size, bn_len * sizeof(uint32_t));
+  if(num_vars > COUNT_ENUM_VARS) {
+    if((nodes = bdd_fixed_count(t, &root, val, nvals)) >= 0) {
+      bn_print(t);
+      printf("\n");
+      return;
+    }
+    if(num_vars > COUNT_ENUM_MAX) {
+      if(nodes == -2)
+        fprintf(stderr, "error: out of memory counting the rows\n");
+      else
+        fprintf(stderr, "error: more than %u BDD nodes needed\n", bdd_limit);
+      return;
+    }
+  }
+
+  printf("%llu\n", (unsigned long long)count_rows(val));
 }
 
-/* free the expression nodes */
-static void free_nodes(void) {
-  free(node);
-  node = NULL;
-  np = 0;
+/* binary tables loaded with -C, to compare with */
+static struct {
+  const char *name;/* file they came from */
+  const char *map;
+  size_t size;
+  size_t pos;/* offset of the next table */
+} stored;
+
+/* map the binary tables in the given file into memory */
+static void load_stored(const char *name) {
+  struct stat st;
+  int fd;
+
+  if((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    die("error: can't open %s\n", name);
+
+  stored.name = name;
+  stored.size = st.st_size;
+  if(stored.size > 0) {
+    stored.map = mmap(NULL, stored.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(stored.map == MAP_FAILED) die("error: can't map %s\n", name);
+  }
+  close(fd);
 }
 
-/* pass tokens to this as if they were being output in RPN, and this function
- * builds the appropriate expression tree */
-static void output(Token *t) {
-  Node *n;
+/* find the next stored table, checking that it is intact. Returns -1 after
+ * printing an error if it isn't */
+static int next_stored(const BinHeader **hp, const char **names,
+                       const uint64_t **data) {
+  const BinHeader *h;
+  const char *p, *end;
+  uint64_t need;
+  uint32_t b;
+
+  if(stored.pos + sizeof(BinHeader) > stored.size) {
+    fprintf(stderr, "error: no more tables in %s\n", stored.name);
+    return -1;
+  }
 
-  /* make another expression node */
-  node = realloc(node, sizeof(Node) * (np + 1));
+  h = (const BinHeader *)(stored.map + stored.pos);
+  if(memcmp(h->magic, BIN_MAGIC, sizeof(h->magic)) != 0
+     || h->version != BIN_VERSION || h->vars > TABLE_VARS_MAX)
+    goto bad;
+
+  /* the data size follows from the number of variables */
+  need = (h->vars > 6) ? (uint64_t)8 << (h->vars - 6) : 8;
+  if(h->data_offset < sizeof(BinHeader) || h->data_offset % BIN_ALIGN != 0
+     || h->data_size != need
+     || stored.size - stored.pos < h->data_offset + h->data_size)
+    goto bad;
+
+  /* the names must all end within the header */
+  p = (const char *)(h + 1);
+  end = (const char *)h + h->data_offset;
+  for(b = 0; b < h->vars; b++) {
+    if(!(p = memchr(p, '\0', end - p))) goto bad;
+    p++;
+  }
 
-  /* get a pointer to the next node */
-  n = node + np++;
+  *hp = h;
+  *names = (const char *)(h + 1);
+  *data = (const uint64_t *)((const char *)h + h->data_offset);
 
-  /* assign type and id */
-  n->type = t->type;
-  if(t->type == OPERATOR) n->id = oper_id(t->text);
-  else if(t->type == VARIABLE) n->id = var_id(t->text);
+  stored.pos += h->data_offset
+              + ((h->data_size + BIN_ALIGN - 1) & ~(uint64_t)(BIN_ALIGN - 1));
+  return 0;
 
-  free_token(t);
+ bad:
+  fprintf(stderr, "error: bad table at offset %zu in %s\n", stored.pos,
+          stored.name);
+  stored.pos = stored.size;
+  return -1;
 }
 
-/* evaluate the expression with the variable values given in 'bits'.
- * return -1 on stack overflow, -2 on underflow, and -3 if there is more than
- * one value left on the stack at the end */
-static int evaluate(uint64_t bits) {
-  char stack[STACK_MAX];
-  int sp = 0;
-  int i, r;
-  int a, b;
+/* compare the expression's table with the next stored one, and print whether
+ * they match, or how many rows differ and one of them */
+static void compare_table(void) {
+  const BinHeader *h;
+  const char *name;
+  const uint64_t *data;
+  static uint64_t *res;
+  static size_t res_size;
+  uint64_t w, j, n, d, valid, diffs = 0, row = 0;
+  size_t fn_size;
+  int b, ours = 0;
+
+  if(compile_expr() < 0 || next_stored(&h, &name, &data) < 0) return;
+
+  /* the variables must be the same, in the same order */
+  for(b = 0; b < num_vars && b < (int)h->vars; b++) {
+    if(strcmp(name, variable[b]) != 0) break;
+    name += strlen(name) + 1;
+  }
+  if(b < num_vars || num_vars != (int)h->vars) {
+    fprintf(stderr, "error: the table in %s has different variables\n",
+            stored.name);
+    return;
+  }
 
-  /* for each expression node */
-  for(i = 0; i < np; i++) {
-    switch(node[i].type) {
-      case VARIABLE:
-        /* push variable value */
-        if(sp >= STACK_MAX) return -1;
-        stack[sp++] = !!(bits & (1 << node[i].id));
-        break;
+  fn_size = table_engine();
+  res = scratch(res, &res_size, table.chunk * sizeof(uint64_t));
 
-      case OPERATOR:
-        /* pop operands */
-        if(sp <= 1) return -2;
-        b = stack[--sp];
-        a = stack[--sp];
-
-        /* calculate result */
-        switch(node[i].id) {
-          case OP_OR:   r = a || b;    break;
-          case OP_AND:  r = a && b;    break;
-          case OP_XOR:  r = a != b;    break;
-          case OP_NAND: r = !(a && b); break;
-          case OP_NOR:  r = !(a || b); break;
-          case OP_IMP:  r = !a || b;   break;
-          case OP_EQU:  r = a == b;    break;
-        }
+  valid = (num_vars < 6) ? ((uint64_t)1 << (1 << num_vars)) - 1 : ~(uint64_t)0;
+  for(w = 0; w < table_words(); w += n) {
+    n = table_words() - w;
+    if(n > table.chunk) n = table.chunk;
 
-        /* push result */
-        if(sp >= STACK_MAX) return -1;
-        stack[sp++] = r;
-        break;
+    evaluate_chunk(table.m, table.fn, w, table.chunk, res);
+    for(j = 0; j < n; j++) {
+      if(!(d = (res[j] ^ data[w + j]) & valid)) continue;
+      if(!diffs) {
+        row = ((w + j) << 6) | __builtin_ctzll(d);
+        ours = (res[j] >> (row & 63)) & 1;
+      }
+      diffs += __builtin_popcountll(d);
+    }
+  }
 
-      case NOT:
-        if(sp <= 0) return -2;
-        stack[sp - 1] = !stack[sp - 1];
-        break;
+  if(table.fn) jit_free(table.fn, fn_size);
+
+  if(!diffs) {
+    printf("tables match\n");
+    return;
+  }
+
+  printf("tables differ in %llu rows, such as:\n", (unsigned long long)diffs);
+  for(b = 0; b < num_vars; b++) printf("%s ", variable[b]);
+  printf("\n");
+  for(b = 0; b < num_vars; b++)
+    printf("%-*c ", (int)strlen(variable[b]), "FT"[(row >> b) & 1]);
+  printf(" %c\n", "FT"[ours]);
+}
+
+/* batch mode, for -b: the input file is mapped and split at line boundaries
+ * into a shard for each worker. Everything about a line is kept in globals,
+ * so the workers are forked processes rather than threads. The first worker
+ * prints straight to stdout and stderr, and the others into temporary files,
+ * which are copied out in order as each worker finishes */
+static int batch;
+
+/* file descriptors kept free of the two per worker for their output */
+#define BATCH_SPARE_FDS 16
+
+/* return whether the line from p to end is a slashvars line */
+static int slashvar_line(const char *p, const char *end) {
+  while(p < end && char_class[(unsigned char)*p] == C_SPACE) p++;
+  return p < end && *p == '/';
+}
+
+/* copy the whole of the file fd to the file descriptor 'to' */
+static void copy_out(int fd, int to) {
+  char buf[65536];
+  ssize_t n, w;
+  char *p;
+
+  if(lseek(fd, 0, SEEK_SET) < 0) die("error: can't read a shard's output\n");
+  while((n = read(fd, buf, sizeof(buf))) != 0) {
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      die("error: can't read a shard's output: %s\n", strerror(errno));
+    }
+    for(p = buf; n > 0; p += w, n -= w) {
+      if((w = write(to, p, n)) < 0) {
+        if(errno == EINTR) {
+          w = 0;
+          continue;
+        }
+        die("error: write failed: %s\n", strerror(errno));
+      }
     }
   }
+}
 
-  if(sp != 1) return -3;
+/* stop the workers that were started, and close the temporary files */
+static void batch_abort(int workers, pid_t *pid, FILE **out, FILE **err) {
+  int i;
 
-  return stack[--sp];
+  for(i = 0; i < workers; i++) {
+    if(pid[i] > 0) {
+      kill(pid[i], SIGKILL);
+      waitpid(pid[i], NULL, 0);
+    }
+    if(out[i]) fclose(out[i]);
+    if(err[i]) fclose(err[i]);
+  }
 }
 
-/* print the truth table for the expression */
-static void print_table(void) {
-  uint64_t i;
-  uint64_t b;
-  int var_len[num_vars];
-  int fail;
+/* split the input between nthreads worker processes. This returns in each
+ * worker, with its shard of the input set up, while the first process writes
+ * out what they print and exits. If the input isn't a file that can be
+ * mapped, it is all read by this process as usual. There are at most as many
+ * workers as the limit on open files allows for their temporary files */
+static void batch_start(void) {
+  int workers = nthreads, i, failed = 0, status, e;
+  size_t cut[workers + 1], off, start, size, pos;
+  FILE *out[workers], *err[workers];
+  pid_t pid[workers];
+  struct rlimit rl;
+  struct stat st;
+  const char *map, *nl;
+
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+    if(rl.rlim_cur < BATCH_SPARE_FDS + 4) return;
+    if((rlim_t)workers > (rl.rlim_cur - BATCH_SPARE_FDS) / 2)
+      workers = (rl.rlim_cur - BATCH_SPARE_FDS) / 2;
+  }
 
-  /* HACK: see if the stack is going to fail before printing the variables */
-  if((fail = evaluate(0)) < 0) {
-    if(fail == -1) fprintf(stderr, "error: stack overflow\n");
-    else if(fail == -2) fprintf(stderr, "error: stack underflow\n");
-    else if(fail == -3) fprintf(stderr, "error: stack not empty\n");
+  /* the input starts wherever stdin has been read up to */
+  if(workers < 2 || fstat(STDIN_FILENO, &st) < 0 || !S_ISREG(st.st_mode)
+     || (pos = lseek(STDIN_FILENO, 0, SEEK_CUR)) == (size_t)-1
+     || pos >= (size_t)st.st_size)
     return;
+  size = st.st_size;
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+  if(map == MAP_FAILED) return;
+
+  /* cut the input into equal parts, moved on to the start of a line. A
+   * slashvars line applies to the line after it, so they stay together */
+  cut[0] = pos;
+  cut[workers] = size;
+  for(i = 1; i < workers; i++) {
+    off = pos + (size - pos) / workers * i;
+    if(off < cut[i - 1]) off = cut[i - 1];
+    if(off > pos && map[off - 1] != '\n') {
+      nl = memchr(map + off, '\n', size - off);
+      off = nl ? (size_t)(nl - map) + 1 : size;
+    }
+    while(off > cut[i - 1]) {
+      nl = (off - 1 > cut[i - 1])
+           ? memrchr(map + cut[i - 1], '\n', off - 1 - cut[i - 1]) : NULL;
+      start = nl ? (size_t)(nl - map) + 1 : cut[i - 1];
+      if(!slashvar_line(map + start, map + off)) break;
+      off = start;
+    }
+    cut[i] = off;
   }
 
-  for(b = 0; b < num_vars; b++) {
-    var_len[b] = strlen(variable[b]);
-    printf("%s ", variable[b]);
+  fflush(stdout);
+  fflush(stderr);
+
+  /* make all the temporary files first, and start the first worker last, so
+   * that nothing has been printed if we have to give up */
+  for(i = 0; i < workers; i++) {
+    pid[i] = 0;
+    out[i] = err[i] = NULL;
+  }
+  for(i = 1; i < workers; i++) {
+    if(cut[i] == cut[i + 1]) continue;
+    if(!(out[i] = tmpfile()) || !(err[i] = tmpfile())) {
+      e = errno;
+      batch_abort(workers, pid, out, err);
+      die("error: can't make a temporary file: %s\n", strerror(e));
+    }
   }
-  printf("\n");
 
-  /* NOTE: comparison between i and -1 works because of
-   * overflow */
-  for(i = (1 << num_vars) - 1; i != -1; i--) {
-    for(b = 0; b < num_vars; b++) {
-        printf("%-*c ", var_len[b], "FT"[!!(i & (1 << b))]);
+  for(i = workers - 1; i >= 0; i--) {
+    if(cut[i] == cut[i + 1]) continue;
+    if((pid[i] = fork()) < 0) {
+      e = errno;
+      batch_abort(workers, pid, out, err);
+      die("error: fork failed: %s\n", strerror(e));
     }
+    if(pid[i] == 0) {
+      if(i > 0 && (dup2(fileno(out[i]), STDOUT_FILENO) < 0
+                   || dup2(fileno(err[i]), STDERR_FILENO) < 0))
+        die("error: can't redirect a shard's output\n");
+      batch_map = map;
+      batch_pos = cut[i];
+      batch_end = cut[i + 1];
+      nthreads = 1;
+      return;
+    }
+  }
 
-    printf(" ");
-    printf("%c\n", "FT"[evaluate(i)]);
+  /* print the output of each shard in order */
+  for(i = 0; i < workers; i++) {
+    if(!pid[i]) continue;
+    if(waitpid(pid[i], &status, 0) < 0 || !WIFEXITED(status)
+       || WEXITSTATUS(status) != 0)
+      failed = 1;
+    if(i > 0) {
+      copy_out(fileno(out[i]), STDOUT_FILENO);
+      copy_out(fileno(err[i]), STDERR_FILENO);
+      fclose(out[i]);
+      fclose(err[i]);
+    }
   }
+
+  exit(failed);
 }
 
 int main(int argc, char **argv) {
-  Token *t;
-  Token *stack[STACK_MAX];
-  int sp = 0;
+  Token t;
   int first_token;
   int slashvar_mode;
+  const char *isa_name = NULL;
+  int analyse = 0, count = 0, ended;
+  struct stat st;
+  int c;
+
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(nthreads < 1) nthreads = 1;
+  if(nthreads > THREADS_MAX) nthreads = THREADS_MAX;
+
+  while((c = getopt(argc, argv, "01abBcC:d:E:F:gi:j:lLm:n:o:r:R:w:x")) != -1) {
+    switch(c) {
+      case '0': only = 0; break;
+      case '1': only = 1; break;
+      case 'a': analyse = 1; break;
+      case 'b': batch = 1; break;
+      case 'B': binary = 1; break;
+      case 'c': count = 1; break;
+      case 'C': load_stored(optarg); break;
+      case 'E':
+        for(mode = 0; mode_name[mode]; mode++)
+          if(strcasecmp(optarg, mode_name[mode]) == 0) break;
+        if(!mode_name[mode]) die("error: unknown mode \"%s\"\n", optarg);
+        break;
+      case 'F':
+        for(format = 0; format_name[format]; format++)
+          if(strcasecmp(optarg, format_name[format]) == 0) break;
+        if(!format_name[format]) die("error: unknown format \"%s\"\n", optarg);
+        break;
+      case 'd':
+        if(!(jit_dump = fopen(optarg, "wb")))
+          die("error: can't open %s\n", optarg);
+        break;
+      case 'g': order = ORDER_GRAY; break;
+      case 'i': isa_name = optarg; break;
+      case 'j': nthreads = parse_threads(optarg); break;
+      case 'l': rle = 1; break;
+      case 'L': left_to_right = 1; break;
+      case 'm': table_mem = parse_size(optarg); break;
+      case 'n':
+        /* keep it a power of two, and small enough for edges to fit */
+        bdd_limit = strtoul(optarg, NULL, 0);
+        if(bdd_limit < (1 << 12)) bdd_limit = 1 << 12;
+        if(bdd_limit > (1u << 30)) bdd_limit = 1u << 30;
+        while(bdd_limit & (bdd_limit - 1)) bdd_limit &= bdd_limit - 1;
+        break;
+      case 'o':
+        /* only a regular file can be extended and mapped. Anything else,
+         * like /dev/null or a pipe, is written to as usual */
+        if((c = open(optarg, O_RDWR | O_CREAT | O_TRUNC, 0666)) >= 0) {
+          map_out = fstat(c, &st) == 0 && S_ISREG(st.st_mode);
+        } else {
+          c = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+          map_out = 0;
+        }
+        if(c < 0 || dup2(c, STDOUT_FILENO) < 0)
+          die("error: can't open %s\n", optarg);
+        close(c);
+        break;
+      case 'r': parse_fixed(optarg); break;
+      case 'R': parse_range(optarg); break;
+      case 'x': result_only = 1; break;
+      case 'w':
+        for(out_method = 0; out_name[out_method]; out_method++)
+          if(strcasecmp(optarg, out_name[out_method]) == 0) break;
+        if(!out_name[out_method]) die("error: unknown output method \"%s\"\n",
+                                        optarg);
+        break;
+      default:
+        die("usage: %s [-01abBcglLx] [-C file] [-d file] "
+            "[-E code|block|table|jit|jitrow|gray] [-F table|csv|tsv|bits] "
+            "[-i avx512|avx2|scalar] "
+            "[-j threads] [-m bytes] [-n nodes] [-o file] [-r var=T|F,...] "
+            "[-R from:to] [-w write|thread|splice]\n", argv[0]);
+    }
+  }
+
+  select_isa(isa_name);
+
+  /* -B and -R only apply to printed tables */
+  if(analyse || count || stored.name) binary = 0;
+  if((binary || analyse || count || stored.name) && (range.from || range.to))
+    die("error: -R only applies to tables printed as text\n");
+  if(binary && rle) die("error: -l can't be used with -B\n");
+  /* each table is compared with the next one stored, in turn */
+  if(batch && stored.name) die("error: -b can't be used with -C\n");
+
+  /* the workers' output may go to files, so this is decided by each of them */
+  if(batch) batch_start();
+
+  if(out_method < 0)
+    out_method = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? OUT_THREAD : OUT_WRITE;
+  if(out_method == OUT_SPLICE) splice_start();
+
+  if(mode < 0) {
+#ifdef HAVE_JIT
+    mode = MODE_JIT;
+#else
+    mode = MODE_CODE;
+#endif
+  }
 
-#define PUSH(t)                                         \
-  do {                                                  \
-    if(sp >= STACK_MAX) {                               \
-      fprintf(stderr, "error: stack overflow\n");       \
-      goto cleanup;                                     \
-    }                                                   \
-    stack[sp++] = (t);                                  \
-  } while(0)
-
-  /* TODO: use getline() or similar */
-  while(fgets(input, 1024, stdin)) {
+  while(next_line()) {
     first_token = 1;
+    ended = 0;
     slashvar_mode = 0;
 
-    /* repeatedly read tokens and use the output() function to convert from RPN
-     * to an expression tree */
-    while((t = next_token())) {
-      if(t->type == UNKNOWN) {
-        fprintf(stderr, "error: unexpected character '%c'\n", *input_ptr);
+    /* repeatedly read tokens and parse them into an expression tree */
+    parse_start();
+    while(next_token(&t)) {
+      if(t.type == UNKNOWN) {
+        fprintf(stderr, "error: unexpected character '%c'\n", input[t.start]);
         goto cleanup;
       }
 
       if(slashvar_mode) {
         /* define the order of variables */
-        if(t->type == VARIABLE) {
+        if(t.type == VARIABLE) {
           /* make the variable exist */
-          var_id(t->text);
+          var_id(input + t.start, t.len);
         } else {
-          fprintf(stderr, "error: non-variable \"%s\" in slashvar line\n",
-                  t->text);
+          fprintf(stderr, "error: non-variable \"%.*s\" in slashvar line\n",
+                  t.len, input + t.start);
+          goto cleanup;
+        }
+      } else if(t.type == SLASHVARS) {
+        if(!first_token) {
+          fprintf(stderr, "error: slashvars can not be embedded in "
+                  "expressions\n");
           goto cleanup;
         }
+        /* clear previous variables. Nothing else from this line is kept,
+         * so the arena can be reset too */
+        clear_vars();
+        arena_reset();
+        /* enter slashvar mode */
+        slashvar_mode = 1;
       } else {
         /* expression evaluation mode */
-        switch(t->type) {
-          case VARIABLE:
-            /* output variable */
-            output(t);
-            break;
-
-          case OPERATOR:
-            /* output operators from the top of the stack */
-            while(sp && (stack[sp-1]->type == OPERATOR
-                      || stack[sp-1]->type == NOT)) {
-              output(stack[--sp]);
-            }
-            /* push operator */
-            PUSH(t);
-            break;
-
-          case LPAREN:
-            /* push lparen */
-            PUSH(t);
-            break;
-
-          case RPAREN:
-            /* pop operators until LPAREN encountered */
-            while(sp && (stack[sp-1]->type != LPAREN)) {
-              output(stack[--sp]);
-            }
-            /* if stack runs out without finding an LPAREN, parentheses are
-             * mismatched */
-            if(sp == 0) {
-              fprintf(stderr, "error: mismatched parentheses\n");
-              goto cleanup;
-            }
-            /* pop and discard LPAREN */
-            free_token(stack[--sp]);
-            /* free RPAREN */
-            free_token(t);
-            break;
-
-          case NOT:
-            /* push operator */
-            PUSH(t);
-            break;
-
-          case SLASHVARS:
-            /* enter slashvar mode */
-            if(!first_token) {
-              fprintf(stderr, "error: slashvars can not be embedded in "
-                      "expressions\n");
-              goto cleanup;
-            }
-            /* clear previous variables */
-            clear_vars();
-            /* enter slashvar mode */
-            slashvar_mode = 1;
-            break;
-        }
+        if(parse_token(&t) < 0) goto cleanup;
       }
 
       /* not the first token any more */
@@ -421,33 +3786,34 @@ int main(int argc, char **argv) {
       continue;
     }
 
-    /* while operators left on stack, output them */
-    while(sp) {
-      /* if any LPAREN's are on the stack, parentheses are mismatched */
-      if(stack[sp-1]->type == LPAREN) {
-        fprintf(stderr, "error: mismatched parentheses\n");
-        goto cleanup;
-      }
-      /* output operator */
-      output(stack[--sp]);
-    }
+    /* output the operators left on the stack */
+    if(parse_end() < 0) goto cleanup;
 
-    /* print the truth table */
-    print_table();
+    /* print the truth table, or the analysis or count of its rows, or
+     * compare it with a stored one */
+    if(analyse) print_analysis();
+    else if(count) print_count();
+    else if(stored.name) compare_table();
+    else ended = print_table();
 
    cleanup:
-    /* free the stack */
-    while(sp) {
-      free_token(stack[--sp]);
-    }
     /* reset the token stream */
     reset_tokstr();
-    /* clear the variables */
+    /* clear the variables, freeing their names */
     clear_vars();
-    /* free the expression nodes */
-    free_nodes();
-
-    printf("\n");
+    arena_reset();
+    /* clear the expression nodes */
+    clear_nodes();
+
+    /* with -R, the blank line after a table belongs to the range that
+     * includes the position after its last row, and the one after an error
+     * to the range starting at 0. table.last + 1 would wrap to 0 for 64
+     * variables, so the position is compared with table.last */
+    if(!binary && (ended ? (range.from <= table.last
+                            || range.from - 1 == table.last)
+                           && (!range.to || range.to - 1 > table.last)
+                         : range.from == 0))
+      printf("\n");
  }
 
   return 0;